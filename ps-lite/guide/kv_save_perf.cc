@@ -0,0 +1,200 @@
+/**
+ * @file   kv_save_perf.cc
+ * @brief  Save and load throughput of the buckets of a KV store, by one record
+ * at a time into a single file as before, by the buffered threads sharing a
+ * single file, and by one buffered shard file per thread
+ *
+ * Usage: kv_save_perf -num_keys 100000000 -nt 8 -prefix /tmp/kv_save_perf
+ *
+ * The loaded pairs are compared with the saved ones, and a small -buf_kb makes
+ * the threads sharing a file interleave their blocks often.
+ */
+#include <random>
+#include <memory>
+#include <mutex>
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+#include "kv/kv_hash_map.h"
+#include "kv/kv_store_io.h"
+#include "base/thread_pool.h"
+#include "base/resource_usage.h"
+
+DEFINE_uint64(num_keys, 10000000, "number of unique keys stored");
+DEFINE_int32(nt, 4, "number of buckets and threads");
+DEFINE_string(prefix, "/tmp/kv_save_perf", "the name of the model files");
+DEFINE_int32(buf_kb, 1 << 16, "the buffer size of a thread in KB");
+
+using Key = ps::Key;
+
+/// \brief the AdaGrad value with an embedding of key-dependent length, saved
+/// as the difacto servers do, so the records have different sizes
+struct Entry {
+  float w = 0;
+  float sq_cum_grad = 0;
+  std::vector<float> V;
+  void Load(dmlc::Stream *fi) {
+    fi->Read(&w, sizeof(w)); fi->Read(&sq_cum_grad, sizeof(sq_cum_grad));
+    int len = 0;
+    fi->Read(&len, sizeof(len));
+    V.resize(len);
+    fi->Read(V.data(), len * sizeof(float));
+  }
+  void Save(dmlc::Stream *fo) const {
+    fo->Write(&w, sizeof(w)); fo->Write(&sq_cum_grad, sizeof(sq_cum_grad));
+    int len = V.size();
+    fo->Write(&len, sizeof(len));
+    fo->Write(V.data(), len * sizeof(float));
+  }
+  bool Empty() const { return w == 0; }
+  bool operator==(const Entry& e) const {
+    return w == e.w && sq_cum_grad == e.sq_cum_grad && V == e.V;
+  }
+};
+
+using Store = ps::OpenAddrHashMap<Key, Entry>;
+
+using ps::Now;
+
+dmlc::Stream* Open(const std::string& name, const char* flag) {
+  return CHECK_NOTNULL(dmlc::Stream::Create(name.c_str(), flag));
+}
+
+int Bucket(Key key) { return key % FLAGS_nt; }
+
+size_t Size(const std::vector<Store>& data) {
+  size_t n = 0;
+  for (const auto& d : data) n += d.size();
+  return n;
+}
+
+size_t Bytes(const std::vector<Store>& data) {
+  size_t n = 0;
+  for (const auto& d : data) {
+    for (const auto& it : d) {
+      n += sizeof(Key) + 2 * sizeof(float) + sizeof(int) +
+           it.second.V.size() * sizeof(float);
+    }
+  }
+  return n;
+}
+
+/// \brief every pair of data is in loaded with the same entry
+void CheckEqual(const std::vector<Store>& data, std::vector<Store>* loaded) {
+  CHECK_EQ(Size(*loaded), Size(data));
+  for (int i = 0; i < FLAGS_nt; ++i) {
+    for (const auto& it : data[i]) {
+      CHECK((*loaded)[i][it.first] == it.second)
+          << "key " << it.first << " is corrupted";
+    }
+  }
+  // no key was missing and inserted by the lookups above
+  CHECK_EQ(Size(*loaded), Size(data));
+}
+
+/// \brief every pair is written and read directly by the stream
+void SaveUnbuffered(const std::vector<Store>& data, ps::ThreadPool* pool) {
+  std::unique_ptr<dmlc::Stream> fo(Open(FLAGS_prefix, "w"));
+  for (const auto& d : data) {
+    for (const auto& it : d) {
+      fo->Write(&it.first, sizeof(it.first));
+      it.second.Save(fo.get());
+    }
+  }
+}
+
+void LoadUnbuffered(std::vector<Store>* data, ps::ThreadPool* pool) {
+  std::unique_ptr<dmlc::Stream> fi(Open(FLAGS_prefix, "r"));
+  ps::LoadEntries<Key>(fi.get(), [data](Key key) -> Entry& {
+      return (*data)[Bucket(key)][key]; });
+}
+
+/// \brief the buckets are serialized in parallel into a shared stream
+void SaveBuffered(const std::vector<Store>& data, ps::ThreadPool* pool) {
+  std::unique_ptr<dmlc::Stream> fo(Open(FLAGS_prefix, "w"));
+  std::mutex mu;
+  for (int i = 0; i < FLAGS_nt; ++i) {
+    pool->Add([&data, &fo, &mu, i]() {
+        ps::BufferedWriter out(fo.get(), (size_t)FLAGS_buf_kb << 10, &mu);
+        ps::SaveEntries(data[i], &out); });
+  }
+  pool->Wait();
+}
+
+void LoadBuffered(std::vector<Store>* data, ps::ThreadPool* pool) {
+  std::unique_ptr<dmlc::Stream> fi(Open(FLAGS_prefix, "r"));
+  ps::BufferedReader in(fi.get());
+  ps::LoadEntries<Key>(&in, [data](Key key) -> Entry& {
+      return (*data)[Bucket(key)][key]; });
+}
+
+/// \brief bucket i is written and read by thread i in its own file
+void SaveSharded(const std::vector<Store>& data, ps::ThreadPool* pool) {
+  for (int i = 0; i < FLAGS_nt; ++i) {
+    pool->Add([&data, i]() {
+        std::unique_ptr<dmlc::Stream> fo(
+            Open(ps::ShardName(FLAGS_prefix, i), "w"));
+        uint64_t cnt = data[i].size();
+        fo->Write(&cnt, sizeof(cnt));
+        ps::BufferedWriter out(fo.get());
+        ps::SaveEntries(data[i], &out); });
+  }
+  pool->Wait();
+}
+
+void LoadSharded(std::vector<Store>* data, ps::ThreadPool* pool) {
+  for (int i = 0; i < FLAGS_nt; ++i) {
+    pool->Add([data, i]() {
+        std::unique_ptr<dmlc::Stream> fi(
+            Open(ps::ShardName(FLAGS_prefix, i), "r"));
+        uint64_t cnt = 0;
+        CHECK_EQ(fi->Read(&cnt, sizeof(cnt)), sizeof(cnt));
+        Store& d = (*data)[i];
+        d.reserve(cnt);
+        ps::BufferedReader in(fi.get());
+        ps::LoadEntries<Key>(&in, [&d](Key key) -> Entry& { return d[key]; });
+      });
+  }
+  pool->Wait();
+}
+
+typedef void (*SaveFunc)(const std::vector<Store>&, ps::ThreadPool*);
+typedef void (*LoadFunc)(std::vector<Store>*, ps::ThreadPool*);
+
+void Run(const char* name, const std::vector<Store>& data, SaveFunc save,
+         LoadFunc load, ps::ThreadPool* pool) {
+  double gb = Bytes(data) / 1e9;
+  double start = Now();
+  save(data, pool);
+  double save_time = Now() - start;
+
+  std::vector<Store> loaded(FLAGS_nt);
+  start = Now();
+  load(&loaded, pool);
+  double load_time = Now() - start;
+  CheckEqual(data, &loaded);
+
+  printf("%18s: save %6.2f GB/s, load %6.2f GB/s\n", name,
+         gb / save_time, gb / load_time);
+}
+
+int main(int argc, char *argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  std::mt19937_64 gen(0);
+  std::vector<Store> data(FLAGS_nt);
+  for (size_t i = 0; i < FLAGS_num_keys; ++i) {
+    Key key = gen();
+    Entry& e = data[Bucket(key)][key];
+    e.w = (key >> 40) + 1; e.sq_cum_grad = key & 0xffff;
+    e.V.resize(key % 4);
+    for (size_t k = 0; k < e.V.size(); ++k) e.V[k] = (key >> (8 * k)) & 0xff;
+  }
+  printf("%zu keys in %d buckets, %.2f GB\n", Size(data), FLAGS_nt,
+         Bytes(data) / 1e9);
+
+  ps::ThreadPool pool(FLAGS_nt);
+  pool.StartWorkers();
+  Run("unbuffered", data, SaveUnbuffered, LoadUnbuffered, &pool);
+  Run("buffered parallel", data, SaveBuffered, LoadBuffered, &pool);
+  Run("sharded", data, SaveSharded, LoadSharded, &pool);
+  return 0;
+}
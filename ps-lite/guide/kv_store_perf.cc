@@ -0,0 +1,94 @@
+/**
+ * @file   kv_store_perf.cc
+ * @brief  Push and pull throughput of the hash maps used by the KV stores
+ *
+ * Usage: kv_store_perf -num_keys 100000000 -batch 10000
+ */
+#include <random>
+#include <algorithm>
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+#include "kv/kv_hash_map.h"
+#include "base/resource_usage.h"
+
+DEFINE_uint64(num_keys, 1000000, "number of unique keys stored");
+DEFINE_int32(batch, 10000, "number of keys in a push or a pull request");
+DEFINE_int32(repeat, 1000, "number of push and pull requests after loading");
+
+using Key = ps::Key;
+
+/// \brief the AdaGrad value of linear methods
+struct Entry {
+  float w = 0;
+  float sq_cum_grad = 0;
+};
+
+using ps::Now;
+
+template <typename Store>
+void Push(const std::vector<Key>& key, const std::vector<float>& grad,
+          Store* data) {
+  size_t n = key.size();
+  for (size_t i = 0; i < n; ++i) {
+    if (i + 8 < n) data->Prefetch(key[i + 8]);
+    Entry& e = (*data)[key[i]];
+    float g = grad[i];
+    e.sq_cum_grad = sqrt(e.sq_cum_grad * e.sq_cum_grad + g * g);
+    e.w -= .1 / (1 + e.sq_cum_grad) * g;
+  }
+}
+
+template <typename Store>
+void Pull(const std::vector<Key>& key, Store* data, std::vector<float>* val) {
+  size_t n = key.size();
+  for (size_t i = 0; i < n; ++i) {
+    if (i + 8 < n) data->Prefetch(key[i + 8]);
+    (*val)[i] = (*data)[key[i]].w;
+  }
+}
+
+template <typename Store>
+void Run(const char* name) {
+  std::mt19937_64 gen(0);
+  std::vector<Key> all(FLAGS_num_keys);
+  for (auto& k : all) k = gen();
+
+  Store data;
+  // load all keys by batches, as the first data pass does
+  double start = Now();
+  std::vector<Key> key;
+  std::vector<float> grad(FLAGS_batch, .1), val(FLAGS_batch);
+  for (size_t i = 0; i < all.size(); i += FLAGS_batch) {
+    size_t end = std::min(all.size(), i + FLAGS_batch);
+    key.assign(all.begin() + i, all.begin() + end);
+    std::sort(key.begin(), key.end());
+    Push(key, grad, &data);
+  }
+  double insert = FLAGS_num_keys / (Now() - start);
+
+  // random sorted batches over the existing keys
+  std::uniform_int_distribution<size_t> dis(0, all.size() - 1);
+  key.resize(FLAGS_batch);
+  double push_time = 0, pull_time = 0;
+  for (int r = 0; r < FLAGS_repeat; ++r) {
+    for (auto& k : key) k = all[dis(gen)];
+    std::sort(key.begin(), key.end());
+    start = Now();
+    Pull(key, &data, &val);
+    pull_time += Now() - start;
+    start = Now();
+    Push(key, grad, &data);
+    push_time += Now() - start;
+  }
+  double ops = (double)FLAGS_repeat * FLAGS_batch;
+  printf("%16s %12zu keys: insert %8.2f Mkeys/s, pull %8.2f Mkeys/s, "
+         "push %8.2f Mkeys/s\n", name, data.size(), insert / 1e6,
+         ops / pull_time / 1e6, ops / push_time / 1e6);
+}
+
+int main(int argc, char *argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  Run<ps::OpenAddrHashMap<Key, Entry>>("open addressing");
+  Run<ps::UnorderedHashMap<Key, Entry>>("unordered_map");
+  return 0;
+}
@@ -1,12 +1,58 @@
 #include "ps.h"
 #include <random>
 #include <algorithm>
+#include <thread>
+#include "base/threadsafe_queue.h"
+#include "base/lock_free_queue.h"
 
 typedef float Val;
 
 DEFINE_int32(repeat, 1000, "repeat n times");
 DEFINE_int32(kv_pair, 1000, "number of key-value pairs a worker send to server each time.");
 DEFINE_string(mode, "online", "online or batch. (TODO)");
+DEFINE_bool(queue, false, "benchmark the in-process message queues only");
+DEFINE_int32(queue_msgs, 1000000, "number of messages each queue benchmark passes");
+DEFINE_int32(max_producers, 32, "the queue benchmark uses 1, 2, 4, ... producers");
+
+using ps::Now;
+
+// the throughput of a queue with num_producers threads pushing message
+// pointers and a single thread popping them, as the postoffice sending thread
+// and the executor processing thread do
+template <typename Queue>
+double QueueThroughput(int num_producers,
+                       std::function<void(Queue*, ps::Message*)> push,
+                       std::function<void(Queue*, ps::Message**)> pop) {
+  Queue queue;
+  ps::Message dummy;
+  int n = FLAGS_queue_msgs / num_producers;
+  double start = Now();
+  std::vector<std::thread> producers;
+  for (int i = 0; i < num_producers; ++i) {
+    producers.emplace_back([&]() {
+        for (int j = 0; j < n; ++j) push(&queue, &dummy);
+      });
+  }
+  ps::Message* msg;
+  for (int64_t i = 0; i < (int64_t)n * num_producers; ++i) pop(&queue, &msg);
+  double time = Now() - start;
+  for (auto& t : producers) t.join();
+  return n * num_producers / time;
+}
+
+void QueuePerf() {
+  using namespace ps;
+  printf("%10s %20s %20s\n", "producers", "mutex msgs/sec", "lock-free msgs/sec");
+  for (int p = 1; p <= FLAGS_max_producers; p *= 2) {
+    double mutex = QueueThroughput<ThreadsafeQueue<Message*>>(
+        p, [](ThreadsafeQueue<Message*>* q, Message* m) { q->push(m); },
+        [](ThreadsafeQueue<Message*>* q, Message** m) { q->wait_and_pop(*m); });
+    double lock_free = QueueThroughput<LockFreeQueue<Message*>>(
+        p, [](LockFreeQueue<Message*>* q, Message* m) { q->Push(m); },
+        [](LockFreeQueue<Message*>* q, Message** m) { q->WaitAndPop(m); });
+    printf("%10d %20.0f %20.0f\n", p, mutex, lock_free);
+  }
+}
 
 int CreateServerNode(int argc, char *argv[]) {
   ps::OnlineServer<Val> server;
@@ -15,6 +61,10 @@ int CreateServerNode(int argc, char *argv[]) {
 
 int WorkerNodeMain(int argc, char *argv[]) {
   using namespace ps;
+  if (FLAGS_queue) {
+    QueuePerf();
+    return 0;
+  }
 
   int n = FLAGS_kv_pair;
   auto key = std::make_shared<std::vector<Key>>();
@@ -35,6 +85,7 @@ int WorkerNodeMain(int argc, char *argv[]) {
   std::vector<Val> recv_val;
 
   KVWorker<Val> wk;
+  double start = Now();
   for (int i = 0; i < FLAGS_repeat; ++i) {
     SyncOpts opts;
     // opts.AddFilter(Filter::KEY_CACHING);
@@ -44,5 +95,8 @@ int WorkerNodeMain(int argc, char *argv[]) {
     ts = wk.ZPull(key, &recv_val, opts);
     wk.Wait(ts);
   }
+  // a push or a pull sends a request and receives a response per server
+  double msgs = 4.0 * FLAGS_repeat * NodeInfo::NumServers();
+  printf("%.0f msgs/sec\n", msgs / (Now() - start));
   return 0;
 }
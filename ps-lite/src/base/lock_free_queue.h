@@ -0,0 +1,248 @@
+/**
+ * @file   lock_free_queue.h
+ * @brief  A bounded lock-free multi-producer multi-consumer queue
+ */
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+namespace ps {
+
+/**
+ * \brief A bounded multi-producer multi-consumer queue.
+ *
+ * It is the array-based queue by Dmitry Vyukov: each cell carries a sequence
+ * number telling whether it is ready to be written or read, so both \ref
+ * TryPush and \ref TryPop take a single CAS in the uncontended case and never
+ * take a lock.
+ *
+ * When the array is full, \ref Push appends to an unbounded overflow list under
+ * a mutex instead of waiting for a consumer, which may be the pushing thread
+ * itself. Once items overflow, the later pushes go to the list too until it is
+ * drained, so the items of a producer are still popped in order.
+ *
+ * A consumer waiting on an empty queue first spins, then yields, and at last
+ * parks on a condition variable. Producers only touch the condition variable
+ * when some consumer is parked, so the common case has no system call.
+ *
+ * Besides new items, a waiting consumer can be woken by \ref Wake. The usage
+ * is:
+ * \code
+ * uint64_t ticket = queue.PrepareWait();
+ * // drain the queue and check other conditions
+ * queue.Wait(ticket);  // returns at once if Wake() was called after PrepareWait
+ * \endcode
+ *
+ * @tparam T the item type, which should be cheap to move, such as a pointer.
+ * Pointers left in the queue when it is destroyed are deleted.
+ */
+template <typename T>
+class LockFreeQueue {
+ public:
+  /**
+   * @param capacity the maximal number of items in the queue, will be rounded
+   * up to a power of 2
+   */
+  explicit LockFreeQueue(size_t capacity = 1 << 16) {
+    size_t cap = 2;
+    while (cap < capacity) cap *= 2;
+    mask_ = cap - 1;
+    cells_.reset(new Cell[cap]);
+    for (size_t i = 0; i < cap; ++i) {
+      cells_[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+  ~LockFreeQueue() {
+    T value;
+    while (TryPop(&value)) Free(value, std::is_pointer<T>());
+  }
+
+  /**
+   * \brief Pushes an item, into the overflow list if the array is full
+   */
+  void Push(T value) {
+    if (overflow_size_.load(std::memory_order_acquire) != 0 ||
+        !TryPush(value)) {
+      std::lock_guard<std::mutex> lk(overflow_mu_);
+      overflow_.push_back(std::move(value));
+      overflow_size_.fetch_add(1, std::memory_order_release);
+    }
+    Notify();
+  }
+
+  /**
+   * \brief Pops an item, blocks if the queue is empty
+   */
+  void WaitAndPop(T* value) {
+    while (!TryPop(value)) Wait(PrepareWait());
+  }
+
+  /**
+   * \brief Pushes an item if the array is not full. Returns false otherwise.
+   * It neither overflows nor wakes the parked consumers, see \ref Push.
+   */
+  bool TryPush(T& value) {
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    Cell* cell;
+    for (;;) {
+      cell = &cells_[pos & mask_];
+      size_t seq = cell->seq.load(std::memory_order_acquire);
+      intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+      if (dif == 0) {
+        if (enqueue_pos_.compare_exchange_weak(
+                pos, pos + 1, std::memory_order_relaxed)) break;
+      } else if (dif < 0) {
+        return false;  // full
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    cell->data = std::move(value);
+    cell->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * \brief Pops an item if the queue is not empty. Returns false otherwise.
+   * The array holds the older items, so the overflow list is only popped when
+   * the array is empty.
+   */
+  bool TryPop(T* value) {
+    if (TryPopArray(value)) return true;
+    if (overflow_size_.load(std::memory_order_acquire) == 0) return false;
+    std::lock_guard<std::mutex> lk(overflow_mu_);
+    // a push that had not seen the list yet may have filled the array since
+    if (TryPopArray(value)) return true;
+    if (overflow_.empty()) return false;
+    *value = std::move(overflow_.front());
+    overflow_.pop_front();
+    overflow_size_.fetch_sub(1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * \brief Returns true if the next item is ready to be popped
+   */
+  bool Ready() const {
+    size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    return cells_[pos & mask_].seq.load(std::memory_order_acquire) == pos + 1 ||
+        overflow_size_.load(std::memory_order_acquire) != 0;
+  }
+
+  /**
+   * \brief Returns a ticket for \ref Wait. Call it before checking the
+   * conditions the waiter is waiting for.
+   */
+  uint64_t PrepareWait() const {
+    return wake_seq_.load(std::memory_order_acquire);
+  }
+
+  /**
+   * \brief Blocks until an item is ready or \ref Wake is called after the
+   * ticket was taken.
+   */
+  void Wait(uint64_t ticket) {
+    auto stop = [this, ticket]() {
+      return Ready() || wake_seq_.load(std::memory_order_acquire) != ticket;
+    };
+    for (int i = 0; i < kSpin + kYield; ++i) {
+      if (stop()) return;
+      Backoff(i);
+    }
+    std::unique_lock<std::mutex> lk(mu_);
+    num_parked_.fetch_add(1);
+    // pairs with the fence in Notify, so either the producer sees the parked
+    // consumer or the consumer sees the item
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    cond_.wait(lk, stop);
+    num_parked_.fetch_sub(1);
+  }
+
+  /**
+   * \brief Wakes up the waiting consumers even if the queue is empty
+   */
+  void Wake() {
+    wake_seq_.fetch_add(1, std::memory_order_release);
+    Notify();
+  }
+
+ private:
+  static const int kSpin = 1 << 10;
+  static const int kYield = 1 << 4;
+
+  struct Cell {
+    std::atomic<size_t> seq;
+    T data;
+  };
+
+  // pops an item from the array if it is not empty
+  bool TryPopArray(T* value) {
+    size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    Cell* cell;
+    for (;;) {
+      cell = &cells_[pos & mask_];
+      size_t seq = cell->seq.load(std::memory_order_acquire);
+      intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+      if (dif == 0) {
+        if (dequeue_pos_.compare_exchange_weak(
+                pos, pos + 1, std::memory_order_relaxed)) break;
+      } else if (dif < 0) {
+        return false;  // empty
+      } else {
+        pos = dequeue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    *value = std::move(cell->data);
+    cell->seq.store(pos + mask_ + 1, std::memory_order_release);
+    return true;
+  }
+
+  static void Free(T& value, std::true_type) { delete value; }
+  static void Free(T& value, std::false_type) { }
+
+  static inline void Backoff(int i) {
+    if (i < kSpin) {
+#if defined(__x86_64__) || defined(__i386__)
+      __builtin_ia32_pause();
+#endif
+    } else {
+      std::this_thread::yield();
+    }
+  }
+
+  void Notify() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (num_parked_.load(std::memory_order_relaxed) == 0) return;
+    { std::lock_guard<std::mutex> lk(mu_); }
+    cond_.notify_all();
+  }
+
+  // pad the hot positions onto different cache lines. use padding rather
+  // than alignas, the queue is often heap allocated as a member
+  static const int kCacheLine = 64;
+  char pad0_[kCacheLine];
+  std::atomic<size_t> enqueue_pos_{0};
+  char pad1_[kCacheLine];
+  std::atomic<size_t> dequeue_pos_{0};
+  char pad2_[kCacheLine];
+  std::atomic<uint64_t> wake_seq_{0};
+  std::atomic<int> num_parked_{0};
+  char pad3_[kCacheLine];
+  size_t mask_;
+  std::unique_ptr<Cell[]> cells_;
+
+  // the items pushed while the array is full
+  std::mutex overflow_mu_;
+  std::deque<T> overflow_;
+  std::atomic<size_t> overflow_size_{0};
+
+  std::mutex mu_;
+  std::condition_variable cond_;
+};
+
+}  // namespace ps
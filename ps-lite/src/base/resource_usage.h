@@ -29,6 +29,12 @@ static double toc(system_clock::time_point start) {
   return (double) ct / 1e3;
 }
 
+// return the seconds of a steady clock, only their differences are meaningful
+inline double Now() {
+  using namespace std::chrono;
+  return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
 // return the time since tic, in milliseconds
 static double milliToc(system_clock::time_point start) {
   size_t ct = std::chrono::duration_cast<std::chrono::milliseconds>(
@@ -0,0 +1,196 @@
+/**
+ * @file   kv_hash_map.h
+ * @brief  Hash maps used by the key-value stores to hold the local KV pairs
+ */
+#pragma once
+#include <atomic>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "ps/base.h"
+namespace ps {
+
+/**
+ * \brief An open-addressing hash map with Robin Hood linear probing.
+ *
+ * Keys, values and probe distances are stored in three flat arrays, so a
+ * lookup touches a few consecutive cache lines instead of following the node
+ * chain of `std::unordered_map`. It implements the subset of the
+ * `std::unordered_map` interface used by \ref KVStoreSparse, plus \ref
+ * Prefetch.
+ *
+ * Each map hashes with its own seed. The iteration order of a map is the order
+ * of its hashes, so copying a map into another one hashing the same way, as
+ * loading a saved model does, would fill the growing table in the order of
+ * its positions and build long probe runs.
+ *
+ * Values are moved when the table grows, so `E` must be default
+ * constructible and movable, and a reference returned by `operator[]` is only
+ * valid until the next insertion.
+ */
+template <typename K, typename E>
+class OpenAddrHashMap {
+ public:
+  OpenAddrHashMap() : seed_(NextSeed()) { Rehash(kMinCapacity); }
+  ~OpenAddrHashMap() { }
+
+  OpenAddrHashMap(OpenAddrHashMap&& other) = default;
+  OpenAddrHashMap& operator=(OpenAddrHashMap&& other) = default;
+
+  /**
+   * \brief Returns the value of a key, inserts a default one if not exists
+   */
+  E& operator[](K key) {
+    size_t i = Hash(key) & mask_;
+    for (uint16_t d = 1; ; ++d, i = (i + 1) & mask_) {
+      if (dist_[i] == 0 || dist_[i] < d) break;
+      if (keys_[i] == key) return vals_[i];
+    }
+    // not found
+    if ((size_ + 1) * kMaxLoadDen > capacity() * kMaxLoadNum) {
+      Rehash(capacity() * 2);
+    }
+    return vals_[Insert(key, E())];
+  }
+
+  /**
+   * \brief Prefetches the first probing position of a key into cache
+   */
+  inline void Prefetch(K key) const {
+    size_t i = Hash(key) & mask_;
+    __builtin_prefetch(&dist_[i]);
+    __builtin_prefetch(&keys_[i]);
+    __builtin_prefetch(&vals_[i]);
+  }
+
+  /**
+   * \brief Makes room for at least n keys without rehashing
+   */
+  void reserve(size_t n) {
+    size_t cap = kMinCapacity;
+    while (cap * kMaxLoadNum < n * kMaxLoadDen) cap *= 2;
+    if (cap > capacity()) Rehash(cap);
+  }
+
+  size_t size() const { return size_; }
+
+  bool empty() const { return size_ == 0; }
+
+  void clear() {
+    keys_.clear(); vals_.clear(); dist_.clear();
+    Rehash(kMinCapacity);
+  }
+
+  /**
+   * \brief Iterates over the occupied positions. Dereferencing returns a
+   * pair with `first` the key and `second` the value.
+   */
+  template <bool kConst>
+  class Iterator {
+   public:
+    using Map = typename std::conditional<
+      kConst, const OpenAddrHashMap, OpenAddrHashMap>::type;
+    using Val = typename std::conditional<kConst, const E, E>::type;
+
+    Iterator(Map* map, size_t i) : map_(map), i_(i) { Skip(); }
+
+    std::pair<const K&, Val&> operator*() const {
+      return std::pair<const K&, Val&>(map_->keys_[i_], map_->vals_[i_]);
+    }
+    Iterator& operator++() { ++ i_; Skip(); return *this; }
+    bool operator!=(const Iterator& other) const { return i_ != other.i_; }
+    bool operator==(const Iterator& other) const { return i_ == other.i_; }
+
+   private:
+    void Skip() {
+      while (i_ < map_->capacity() && map_->dist_[i_] == 0) ++ i_;
+    }
+    Map* map_;
+    size_t i_;
+  };
+  using iterator = Iterator<false>;
+  using const_iterator = Iterator<true>;
+
+  iterator begin() { return iterator(this, 0); }
+  iterator end() { return iterator(this, capacity()); }
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, capacity()); }
+
+ private:
+  static const size_t kMinCapacity = 16;
+  // maximal load factor kMaxLoadNum / kMaxLoadDen
+  static const size_t kMaxLoadNum = 4;
+  static const size_t kMaxLoadDen = 5;
+
+  size_t capacity() const { return dist_.size(); }
+
+  inline size_t Hash(K key) const {
+    // the finalizer of murmurhash3. keys within a server's key range often
+    // share the high bits, so mix all bits into the low ones
+    uint64_t x = static_cast<uint64_t>(key) ^ seed_;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return static_cast<size_t>(x);
+  }
+
+  static uint64_t NextSeed() {
+    static std::atomic<uint64_t> n(0);
+    return (++ n) * 0x9e3779b97f4a7c15ULL;
+  }
+
+  // inserts a key known not to exist, returns its position
+  size_t Insert(K key, E&& val) {
+    size_t i = Hash(key) & mask_, pos = capacity();
+    E cur_val(std::move(val));
+    for (uint16_t d = 1; ; ++d, i = (i + 1) & mask_) {
+      CHECK_LT(d, (uint16_t)65535) << "too many collisions";
+      if (dist_[i] == 0) {
+        keys_[i] = key; vals_[i] = std::move(cur_val); dist_[i] = d;
+        ++ size_;
+        return pos == capacity() ? i : pos;
+      }
+      if (dist_[i] < d) {
+        // robin hood: take the position from a richer key
+        std::swap(keys_[i], key);
+        std::swap(vals_[i], cur_val);
+        std::swap(dist_[i], d);
+        if (pos == capacity()) pos = i;
+      }
+    }
+  }
+
+  void Rehash(size_t cap) {
+    std::vector<K> keys(cap);
+    std::vector<E> vals(cap);
+    std::vector<uint16_t> dist(cap, 0);
+    keys.swap(keys_); vals.swap(vals_); dist.swap(dist_);
+    mask_ = cap - 1;
+    size_ = 0;
+    for (size_t i = 0; i < dist.size(); ++i) {
+      if (dist[i]) Insert(keys[i], std::move(vals[i]));
+    }
+  }
+
+  std::vector<K> keys_;
+  std::vector<E> vals_;
+  // 0 means empty, otherwise 1 + the distance to the key's home position
+  std::vector<uint16_t> dist_;
+  size_t mask_ = 0;
+  size_t size_ = 0;
+  uint64_t seed_;
+};
+
+/**
+ * \brief `std::unordered_map` with the interface of \ref OpenAddrHashMap
+ */
+template <typename K, typename E>
+class UnorderedHashMap : public std::unordered_map<K, E> {
+ public:
+  inline void Prefetch(K key) const { }
+};
+
+}  // namespace ps
@@ -14,6 +14,17 @@ class KVStore : public Customer {
   virtual void Save(dmlc::Stream *fo) const = 0;
   virtual void Clear() = 0;
 
+  /// @brief save into fo and the shard files ShardName(prefix, i), which are
+  /// written in parallel. the default saves all into fo
+  virtual void SaveSharded(dmlc::Stream *fo, const std::string& prefix) const {
+    Save(fo);
+  }
+
+  /// @brief load what \ref SaveSharded saved with the same prefix
+  virtual void LoadSharded(dmlc::Stream *fi, const std::string& prefix) {
+    Load(fi);
+  }
+
   // handle system call
   void ProcessRequest(Message* request) {
     const auto& call = request->task.param();
@@ -0,0 +1,192 @@
+/**
+ * @file   kv_store_io.h
+ * @brief  Buffered saving and loading of the key-value pairs of a KV store
+ */
+#pragma once
+#include <string.h>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "dmlc/io.h"
+#include "dmlc/logging.h"
+namespace ps {
+
+/**
+ * \brief Collects the many small writes of the serialized entries and writes
+ * them into the underlying stream in blocks of about buf_size bytes. If mu is
+ * given, it is held while writing a block, so threads can share a stream.
+ *
+ * A block is only written by \ref EndRecord, so it holds whole records, and
+ * the records of the threads sharing a stream interleave but never split.
+ */
+class BufferedWriter : public dmlc::Stream {
+ public:
+  BufferedWriter(dmlc::Stream* fo, size_t buf_size = kDefaultSize,
+                 std::mutex* mu = nullptr)
+      : fo_(fo), buf_size_(buf_size), mu_(mu) {
+    buf_.reserve(buf_size_);
+  }
+  virtual ~BufferedWriter() { Flush(); }
+
+  static const size_t kDefaultSize = 1 << 26;
+
+  virtual size_t Read(void* ptr, size_t size) {
+    LOG(FATAL) << "write only"; return 0;
+  }
+
+  virtual void Write(const void* ptr, size_t size) {
+    buf_.append((const char*)ptr, size);
+  }
+
+  /// \brief marks the end of a record, writes a block if the buffer is full
+  void EndRecord() {
+    if (buf_.size() >= buf_size_) Flush();
+  }
+
+  /// \brief writes the buffered bytes into the underlying stream
+  void Flush() {
+    if (buf_.empty()) return;
+    if (mu_) {
+      std::lock_guard<std::mutex> lk(*mu_);
+      fo_->Write(buf_.data(), buf_.size());
+    } else {
+      fo_->Write(buf_.data(), buf_.size());
+    }
+    bytes_ += buf_.size();
+    buf_.clear();
+  }
+
+  /// \brief the bytes written into the underlying stream
+  size_t bytes() const { return bytes_; }
+
+ private:
+  dmlc::Stream* fo_;
+  size_t buf_size_;
+  std::mutex* mu_;
+  std::string buf_;
+  size_t bytes_ = 0;
+};
+
+/**
+ * \brief Reads the underlying stream in blocks of buf_size bytes and serves
+ * the small reads of the serialized entries from the block.
+ */
+class BufferedReader : public dmlc::Stream {
+ public:
+  BufferedReader(dmlc::Stream* fi, size_t buf_size = BufferedWriter::kDefaultSize)
+      : fi_(fi), buf_(buf_size) { }
+  virtual ~BufferedReader() { }
+
+  virtual size_t Read(void* ptr, size_t size) {
+    char* p = (char*)ptr;
+    size_t n = 0;
+    while (n < size) {
+      if (pos_ == end_) {
+        pos_ = 0;
+        end_ = fi_->Read(buf_.data(), buf_.size());
+        bytes_ += end_;
+        if (end_ == 0) break;
+      }
+      size_t m = std::min(size - n, end_ - pos_);
+      memcpy(p + n, buf_.data() + pos_, m);
+      pos_ += m; n += m;
+    }
+    return n;
+  }
+
+  virtual void Write(const void* ptr, size_t size) {
+    LOG(FATAL) << "read only";
+  }
+
+  /// \brief the bytes read from the underlying stream
+  size_t bytes() const { return bytes_; }
+
+ private:
+  dmlc::Stream* fi_;
+  std::vector<char> buf_;
+  size_t pos_ = 0, end_ = 0;
+  size_t bytes_ = 0;
+};
+
+/**
+ * \brief writes the non-empty pairs of data as the key followed by the entry
+ * into fo. Returns the number of pairs written
+ */
+template <typename Store>
+size_t SaveEntries(const Store& data, BufferedWriter* fo) {
+  size_t n = 0;
+  for (const auto& it : data) {
+    if (it.second.Empty()) continue;
+    fo->Write(&it.first, sizeof(it.first));
+    it.second.Save(fo);
+    fo->EndRecord();
+    ++ n;
+  }
+  return n;
+}
+
+/**
+ * \brief reads the pairs written by \ref SaveEntries until the end of fi,
+ * loading each into get(key). Returns the number of pairs read
+ */
+template <typename K, typename Get>
+size_t LoadEntries(dmlc::Stream* fi, Get get) {
+  size_t n = 0;
+  K key;
+  while (fi->Read(&key, sizeof(K)) == sizeof(K)) {
+    get(key).Load(fi);
+    ++ n;
+  }
+  return n;
+}
+
+/// \brief the file of shard i of a model saved with the name prefix
+inline std::string ShardName(const std::string& prefix, int i) {
+  return prefix + "_shard-" + std::to_string(i);
+}
+
+/**
+ * \brief writes the non-empty pairs of data into the shard file, starting with
+ * their number. Returns the number of pairs written
+ */
+template <typename Store>
+size_t SaveShard(const Store& data, const std::string& file) {
+  std::unique_ptr<dmlc::Stream> fo(
+      CHECK_NOTNULL(dmlc::Stream::Create(file.c_str(), "w")));
+  uint64_t cnt = 0;
+  for (const auto& it : data) cnt += !it.second.Empty();
+  fo->Write(&cnt, sizeof(cnt));
+  BufferedWriter out(fo.get());
+  return SaveEntries(data, &out);
+}
+
+/**
+ * \brief reads a shard file written by \ref SaveShard. reserve is called with
+ * the number of pairs first, and then each pair is loaded into get(key).
+ * Returns the number of pairs read
+ */
+template <typename K, typename Reserve, typename Get>
+size_t LoadShard(const std::string& file, Reserve reserve, Get get) {
+  std::unique_ptr<dmlc::Stream> fi(
+      CHECK_NOTNULL(dmlc::Stream::Create(file.c_str(), "r")));
+  uint64_t cnt = 0;
+  CHECK_EQ(fi->Read(&cnt, sizeof(cnt)), sizeof(cnt)) << "bad shard " << file;
+  reserve(cnt);
+  BufferedReader in(fi.get());
+  return LoadEntries<K>(&in, get);
+}
+
+/**
+ * \brief reads the number of shards after the handle in the model file of a
+ * sharded model
+ */
+inline int ReadNumShards(dmlc::Stream* fi) {
+  int32_t n = 0;
+  CHECK_EQ(fi->Read(&n, sizeof(n)), sizeof(n));
+  CHECK_GT(n, 0) << "bad number of shards in the model";
+  return n;
+}
+
+}  // namespace ps
@@ -1,10 +1,14 @@
 #pragma once
+#include <memory>
 #include "kv/kv_store.h"
+#include "kv/kv_hash_map.h"
+#include "kv/kv_store_io.h"
 #include "base/thread_pool.h"
 #include "ps/node_info.h"
 namespace ps {
 
-template<typename K, typename E, typename V, typename Handle>
+template<typename K, typename E, typename V, typename Handle,
+         typename Store = OpenAddrHashMap<K, E> >
 class KVStoreSparse : public KVStore {
  public:
   KVStoreSparse(int id, Handle handle, int pull_val_len, int nt)
@@ -15,13 +19,16 @@ class KVStoreSparse : public KVStore {
     min_key_ = kr.begin();
     bucket_size_ = (kr.end() - kr.begin() -1 ) / nt_ + 1;
     key_pos_.resize(nt_+1);
+    val_pos_.resize(nt_+1);
+    dyn_buf_.resize(nt_);
+    dyn_len_.resize(nt_);
     pool_.StartWorkers();
   }
 
   virtual ~KVStoreSparse() { }
 
   void Clear() override {
-    data_.clear();
+    for (auto& d : data_) d.clear();
   }
 
   // process a pull message
@@ -30,36 +37,34 @@ class KVStoreSparse : public KVStore {
     handle_.Start(false, ts, msg->task.cmd(), (void*)msg);
     SArray<K> key(msg->key);
     size_t n = key.size();
-    SArray<V> val(n * k_);
     bool dyn = msg->task.param().dyn_val_size();
+
+    SliceKey(key.data(), n);
+
     if (dyn) {
       SArray<int> val_size(n);
-      size_t start = 0;
-      for (size_t i = 0; i < n; ++i) {
-        K key_i = key[i];
-        size_t len = val.size() - start;
-        while (len < (size_t)k_) {
-          val.resize(val.size()*2 + 5); len = val.size() - start;
-        }
-        V* val_data = val.data() + start;
-        Blob<V> pull(val_data, len);
-        handle_.Pull(key_i, data_[0][key_i], pull);
-        if (pull.data != val_data) {
-          while ((start + pull.size) > val.size()) val.resize(val.size()*2 + 5);
-          memcpy(val.data()+start, pull.data, sizeof(V)*pull.size);
-        } else {
-          CHECK_LE(pull.size, len);
-        }
-        start += pull.size;
-        val_size[i] = pull.size;
+      // pull into the per-thread buffers
+      for (int i = 0; i < nt_; ++i) {
+        pool_.Add([this, &key, &val_size, i](){
+            ThreadDynPull(key.data(), val_size.data(), i); });
       }
-      val.resize(start);
+      pool_.Wait();
+
+      // each thread then copies its values to [val_pos_[i], val_pos_[i+1])
+      val_pos_[0] = 0;
+      for (int i = 0; i < nt_; ++i) val_pos_[i+1] = val_pos_[i] + dyn_len_[i];
+      SArray<V> val(val_pos_[nt_]);
+      for (int i = 0; i < nt_; ++i) {
+        pool_.Add([this, &val, i](){
+            memcpy(val.data() + val_pos_[i], dyn_buf_[i].data(),
+                   sizeof(V) * dyn_len_[i]); });
+      }
+      pool_.Wait();
+
       msg->add_value(val);
       msg->add_value(val_size);
     } else {
-
-      SliceKey(key.data(), n);
-
+      SArray<V> val(n * k_);
       for (int i = 0; i < nt_; ++i) {
         pool_.Add([this, &key, &val, n, i](){
             ThreadPull(key.data(), val.data(), n, k_, i); });
@@ -87,18 +92,23 @@ class KVStoreSparse : public KVStore {
       SArray<V> val(msg->value[0]);
       SArray<int> val_size(msg->value[1]);
       CHECK_EQ(val_size.size(), n);
-      size_t len = 0;
-      for (int i : val_size) len += i;
-      CHECK_EQ(len, val.size());
-
-      V* val_data = val.data();
-      for (size_t i = 0; i < n; ++i) {
-        K key_i = key[i];
-        size_t k = val_size[i];
-        if (k == 0) continue;
-        handle_.Push(key_i, Blob<const V>(val_data, k), data_[0][key_i]);
-        val_data += k;
+
+      SliceKey(key.data(), n);
+
+      // the values of thread i start from val_pos_[i]
+      val_pos_[0] = 0;
+      for (int i = 0; i < nt_; ++i) {
+        size_t len = 0;
+        for (int j = key_pos_[i]; j < key_pos_[i+1]; ++j) len += val_size[j];
+        val_pos_[i+1] = val_pos_[i] + len;
+      }
+      CHECK_EQ(val_pos_[nt_], val.size());
+
+      for (int i = 0; i < nt_; ++i) {
+        pool_.Add([this, &key, &val, &val_size, i](){
+            ThreadDynPush(key.data(), val.data(), val_size.data(), i); });
       }
+      pool_.Wait();
     } else if (!dyn && n) {
       CHECK_EQ(msg->value.size(), (size_t)1);
       SArray<V> val(msg->value[0]);
@@ -120,81 +130,182 @@ class KVStoreSparse : public KVStore {
 
   virtual void Load(dmlc::Stream *fi) {
     handle_.Load(fi);
-    K key;
-    while (true) {
-      if (fi->Read(&key, sizeof(K)) != sizeof(K)) break;
-      GetValue(key).Load(fi);
-    }
-    int size = 0;
-    for (int i = 0; i < nt_; ++i) {
-      LOG(INFO) << "bucket " << i << " [" <<
-          min_key_ + i * bucket_size_ << ", " <<
-          min_key_ + (i+1) * bucket_size_ << ") " <<
-          data_[i].size();
-      size += data_[i].size();
-    }
-    LOG(INFO) << "loaded " << size << " kv pairs in total";
+    BufferedReader in(fi);
+    LoadEntries<K>(&in, [this](K key) -> E& { return GetValue(key); });
+    std::vector<size_t> size(nt_);
+    for (int i = 0; i < nt_; ++i) size[i] = data_[i].size();
+    LogBuckets("loaded", size);
   }
 
+  // the buckets are serialized in parallel, and the blocks of different
+  // buckets are interleaved in fo at record boundaries, which Load does not
+  // mind
   virtual void Save(dmlc::Stream *fo) const {
     handle_.Save(fo);
-    int saved = 0;
+    std::mutex mu;
+    std::vector<size_t> saved(nt_);
+    for (int i = 0; i < nt_; ++i) {
+      pool_.Add([this, fo, &mu, &saved, i]() {
+          BufferedWriter out(fo, BufferedWriter::kDefaultSize, &mu);
+          saved[i] = SaveEntries(data_[i], &out); });
+    }
+    pool_.Wait();
+    LogBuckets("saved", saved);
+  }
 
+  // fo has the handle and the number of shards, and bucket i is saved into
+  // shard i, starting with its number of pairs
+  virtual void SaveSharded(dmlc::Stream *fo, const std::string& prefix) const {
+    handle_.Save(fo);
+    int32_t n = nt_;
+    fo->Write(&n, sizeof(n));
+    std::vector<size_t> saved(nt_);
     for (int i = 0; i < nt_; ++i) {
-      int s = 0;
-      for (const auto& it : data_[i]) {
-        if (it.second.Empty()) continue;
-        fo->Write(&it.first, sizeof(K));
-        it.second.Save(fo);
-        ++ s;
+      pool_.Add([this, &prefix, &saved, i]() {
+          saved[i] = SaveShard(data_[i], ShardName(prefix, i)); });
+    }
+    pool_.Wait();
+    LogBuckets("saved", saved);
+  }
+
+  virtual void LoadSharded(dmlc::Stream *fi, const std::string& prefix) {
+    handle_.Load(fi);
+    int n = ReadNumShards(fi);
+    if (n == nt_) {
+      // shard i is bucket i, loaded by thread i into the pre-sized table
+      for (int i = 0; i < nt_; ++i) {
+        pool_.Add([this, &prefix, i]() {
+            LoadShard<K>(ShardName(prefix, i), [this, i](uint64_t cnt) {
+                data_[i].reserve(data_[i].size() + cnt);
+              }, [this, i](K key) -> E& {
+                CHECK_EQ(Bucket(key), i)
+                    << "the model was saved with a different key range";
+                return data_[i][key]; }); });
+      }
+      pool_.Wait();
+    } else {
+      // saved with a different number of threads, the keys of a shard may go
+      // to any bucket
+      for (int i = 0; i < n; ++i) {
+        LoadShard<K>(ShardName(prefix, i), [](uint64_t cnt) { },
+                     [this](K key) -> E& { return GetValue(key); });
       }
-      LOG(INFO) << "bucket " << i << " [" <<
-          min_key_ + i * bucket_size_ << ", " <<
-          min_key_ + (i+1) * bucket_size_ << "): " << s;
-      saved += s;
     }
-    LOG(INFO) << "saved " << saved << " kv pairs in total";
+    std::vector<size_t> size(nt_);
+    for (int i = 0; i < nt_; ++i) size[i] = data_[i].size();
+    LogBuckets("loaded", size);
   }
 
  private:
-  std::vector<std::unordered_map<K, E>> data_;
+  // prefetch the value of the key kPrefetch positions ahead in the sorted key
+  // list
+  static const int kPrefetch = 8;
+
+  std::vector<Store> data_;
   Handle handle_;
   int k_, nt_;
 
   K min_key_;
   K bucket_size_;
 
-  ThreadPool pool_;
+  // mutable as Save runs on it
+  mutable ThreadPool pool_;
 
+  // keys in [key_pos_[i], key_pos_[i+1]) are stored in data_[i]
   std::vector<int> key_pos_;
+  // for dynamic length values, thread i reads or writes [val_pos_[i],
+  // val_pos_[i+1]) of the value array
+  std::vector<size_t> val_pos_;
+  // the values pulled by thread i are dyn_buf_[i][0, dyn_len_[i])
+  std::vector<std::vector<V>> dyn_buf_;
+  std::vector<size_t> dyn_len_;
+
+  void LogBuckets(const char* action, const std::vector<size_t>& size) const {
+    size_t total = 0;
+    for (int i = 0; i < nt_; ++i) {
+      LOG(INFO) << "bucket " << i << " [" <<
+          min_key_ + i * bucket_size_ << ", " <<
+          min_key_ + (i+1) * bucket_size_ << "): " << size[i];
+      total += size[i];
+    }
+    LOG(INFO) << action << " " << total << " kv pairs in total";
+  }
 
+  // partition the sorted keys in the same way as Bucket()
   void SliceKey(K* key, int n) {
     key_pos_[0] = 0;
     for (int i = 1; i < nt_; ++i) {
       K k = min_key_ + bucket_size_ * i;
       key_pos_[i] = std::lower_bound(key + key_pos_[i-1], key + n, k) - key;
-      LOG(ERROR) << key_pos_[i] - key_pos_[i-1];
     }
     key_pos_[nt_] = n;
   }
 
+  int Bucket(K key) const {
+    if (key < min_key_) return 0;
+    return std::min((int)((key - min_key_) / bucket_size_), nt_ - 1);
+  }
+
   E& GetValue(K key) {
-    return data_[(key - min_key_) / bucket_size_][key];
+    return data_[Bucket(key)][key];
   }
 
   void ThreadPush(K* key, V* val, int n, int k, int tid) {
     auto& data = data_[tid];
     val += key_pos_[tid] * k;
-    for (int i = key_pos_[tid]; i < key_pos_[tid+1]; ++i, val += k) {
+    int end = key_pos_[tid+1];
+    for (int i = key_pos_[tid]; i < end; ++i, val += k) {
+      if (i + kPrefetch < end) data.Prefetch(key[i + kPrefetch]);
       K key_i = key[i];
       handle_.Push(key_i, Blob<const V>(val, k), data[key_i]);
     }
   }
 
+  void ThreadDynPush(K* key, V* val, int* val_size, int tid) {
+    auto& data = data_[tid];
+    val += val_pos_[tid];
+    int end = key_pos_[tid+1];
+    for (int i = key_pos_[tid]; i < end; ++i) {
+      if (i + kPrefetch < end) data.Prefetch(key[i + kPrefetch]);
+      size_t k = val_size[i];
+      if (k == 0) continue;
+      handle_.Push(key[i], Blob<const V>(val, k), data[key[i]]);
+      val += k;
+    }
+  }
+
+  void ThreadDynPull(K* key, int* val_size, int tid) {
+    auto& data = data_[tid];
+    auto& buf = dyn_buf_[tid];
+    size_t start = 0;
+    int end = key_pos_[tid+1];
+    for (int i = key_pos_[tid]; i < end; ++i) {
+      if (i + kPrefetch < end) data.Prefetch(key[i + kPrefetch]);
+      if (buf.size() < start + k_) buf.resize(buf.size() * 2 + k_);
+      V* val_data = buf.data() + start;
+      size_t len = buf.size() - start;
+      Blob<V> pull(val_data, len);
+      handle_.Pull(key[i], data[key[i]], pull);
+      if (pull.data != val_data) {
+        if (buf.size() < start + pull.size) {
+          buf.resize(buf.size() * 2 + pull.size);
+        }
+        memcpy(buf.data() + start, pull.data, sizeof(V)*pull.size);
+      } else {
+        CHECK_LE(pull.size, len);
+      }
+      start += pull.size;
+      val_size[i] = pull.size;
+    }
+    dyn_len_[tid] = start;
+  }
+
   void ThreadPull(K* key, V* val, int n, int k, int tid) {
     auto& data = data_[tid];
     val += key_pos_[tid] * k;
-    for (int i = key_pos_[tid]; i < key_pos_[tid+1]; ++i, val += k) {
+    int end = key_pos_[tid+1];
+    for (int i = key_pos_[tid]; i < end; ++i, val += k) {
+      if (i + kPrefetch < end) data.Prefetch(key[i + kPrefetch]);
       K key_i = key[i];
       Blob<V> pull(val, k);
       handle_.Pull(key_i, data[key_i], pull);
@@ -1,8 +1,11 @@
 #pragma once
 #include "kv/kv_store.h"
+#include "kv/kv_hash_map.h"
+#include "kv/kv_store_io.h"
 namespace ps {
 
-template<typename K, typename E, typename V, typename Handle>
+template<typename K, typename E, typename V, typename Handle,
+         typename Store = OpenAddrHashMap<K, E> >
 class KVStoreSparseST : public KVStore {
  public:
   KVStoreSparseST(int id, Handle handle, int pull_val_len)
@@ -28,6 +31,7 @@ class KVStoreSparseST : public KVStore {
       SArray<int> val_size(n);
       size_t start = 0;
       for (size_t i = 0; i < n; ++i) {
+        if (i + kPrefetch < n) data_.Prefetch(key[i + kPrefetch]);
         K key_i = key[i];
         size_t len = val.size() - start;
         while (len < (size_t)k_) {
@@ -51,6 +55,7 @@ class KVStoreSparseST : public KVStore {
     } else {
       V* val_data = val.data();
       for (size_t i = 0; i < n; ++i, val_data += k_) {
+        if (i + kPrefetch < n) data_.Prefetch(key[i + kPrefetch]);
         K key_i = key[i];
         Blob<V> pull(val_data, k_);
         handle_.Pull(key_i, data_[key_i], pull);
@@ -86,6 +91,7 @@ class KVStoreSparseST : public KVStore {
 
       V* val_data = val.data();
       for (size_t i = 0; i < n; ++i) {
+        if (i + kPrefetch < n) data_.Prefetch(key[i + kPrefetch]);
         K key_i = key[i];
         size_t k = val_size[i];
         if (k == 0) continue;
@@ -100,6 +106,7 @@ class KVStoreSparseST : public KVStore {
 
       V* val_data = val.data();
       for (size_t i = 0; i < n; ++i, val_data += k) {
+        if (i + kPrefetch < n) data_.Prefetch(key[i + kPrefetch]);
         K key_i = key[i];
         handle_.Push(key_i, Blob<const V>(val_data, k), data_[key_i]);
       }
@@ -130,8 +137,33 @@ class KVStoreSparseST : public KVStore {
     LOG(INFO) << "saved " << saved << " kv pairs";
   }
 
+  // a single shard in the layout of KVStoreSparse::SaveSharded, so a model
+  // sharded by either store can be loaded by the other
+  virtual void SaveSharded(dmlc::Stream *fo, const std::string& prefix) const {
+    handle_.Save(fo);
+    int32_t n = 1;
+    fo->Write(&n, sizeof(n));
+    size_t saved = SaveShard(data_, ShardName(prefix, 0));
+    LOG(INFO) << "saved " << saved << " kv pairs";
+  }
+
+  virtual void LoadSharded(dmlc::Stream *fi, const std::string& prefix) {
+    handle_.Load(fi);
+    int n = ReadNumShards(fi);
+    for (int i = 0; i < n; ++i) {
+      LoadShard<K>(ShardName(prefix, i), [this](uint64_t cnt) {
+          data_.reserve(data_.size() + cnt);
+        }, [this](K key) -> E& { return data_[key]; });
+    }
+    LOG(INFO) << "loaded " << data_.size() << " kv pairs";
+  }
+
  private:
-  std::unordered_map<K, E> data_;
+  // prefetch the value of the key kPrefetch positions ahead in the sorted key
+  // list
+  static const int kPrefetch = 8;
+
+  Store data_;
   Handle handle_;
   int k_;
 };
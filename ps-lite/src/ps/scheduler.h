@@ -91,7 +91,8 @@ class Root : public Customer {
   ~Root() { }
 
   /**
-   * \brief Get the received (and reduced) vector from servers/workers
+   * \brief Get the received (and reduced) vector from servers/workers. For
+   * PLUS, the vectors may have different lengths, and the sum has the longest
    *
    * System will clear the received data
    * \param vals the value vector.
@@ -113,9 +114,13 @@ class Root : public Customer {
       if (n == 0) return;
       std::vector<Val> recv(n);
       memcpy(recv.data(), task.msg().data(), task.msg().size());
-      if (recv_.size() == 0) recv_.resize(recv.size());
-      CHECK_EQ(recv.size(), recv_.size());
       CHECK(task.has_op());
+      if (recv.size() != recv_.size() && recv_.size() != 0) {
+        // the missing tail of the shorter vector is taken as zeros, which is
+        // only right for a sum
+        CHECK_EQ(task.op(), AsOp::PLUS) << "vectors of different lengths";
+      }
+      if (recv_.size() < recv.size()) recv_.resize(recv.size());
       for (size_t i = 0; i < recv.size(); ++i) {
         AssignOp(recv_[i], recv[i], task.op());
       }
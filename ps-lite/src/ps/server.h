@@ -9,15 +9,14 @@
 #include "proto/task.pb.h"
 #include "kv/kv_store_sparse.h"
 #include "kv/kv_store_sparse_st.h"
-// #include "kv/kv_store_cuckoo.h"
 namespace ps {
 
 /**
  * @brief An example of the user-defined value for \ref OnlineServer
  *
  * The constructor function is called when the according key does not
- * exist. This class must be copyable and assignable (movable), which are only
- * called once with the constructor function, e.g. ``std::unordered_map::insert(IVal<Val>())``. It
+ * exist. This class must be movable, because the open-addressing hash map
+ * (see \ref OpenAddrHashMap) moves values when it grows. It
  * also must implement the following three functions \ref Load, \ref Save and
  * \ref Empty
  */
@@ -174,8 +173,6 @@ class OnlineServer {
       server_ = new KVStoreSparse<Key, Val, SyncV, Handle>(
           id, handle, pull_val_len, num_threads);
     }
-    // server_ = new KVStoreCuckoo<Key, Val, SyncV, Handle>(
-    //     id, handle, pull_val_len, num_threads);
     Postoffice::instance().manager().TransferCustomer(CHECK_NOTNULL(server_));
   }
 
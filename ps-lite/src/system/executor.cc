@@ -21,8 +21,7 @@ Executor::~Executor() {
   done_ = true;
 
   // wake thread_
-  { Lock l(msg_mu_); }
-  dag_cond_.notify_all();
+  recv_queue_.Wake();
 
   CHECK_NOTNULL(thread_)->join();
   delete thread_;
@@ -100,8 +99,7 @@ void Executor::FinishRecvReq(int timestamp, const NodeID& sender) {
   lk.unlock();
   recv_req_cond_.notify_all();
 
-  { Lock lk(msg_mu_); }
-  dag_cond_.notify_all();
+  recv_queue_.Wake();
 }
 
 
@@ -168,7 +166,11 @@ void Executor::Reply(Message* request, Message* response) {
 }
 
 bool Executor::PickActiveMsg() {
-  std::unique_lock<std::mutex> lk(msg_mu_);
+  // take the ticket before checking the dependencies, so a FinishRecvReq
+  // happening in between is not missed
+  uint64_t ticket = recv_queue_.PrepareWait();
+  Message* accepted;
+  while (recv_queue_.TryPop(&accepted)) recv_msgs_.push_back(accepted);
   // VLOG(1) << obj_.id() << ": try to pick a message";
   auto it = recv_msgs_.begin();
   while (it != recv_msgs_.end()) {
@@ -232,7 +234,7 @@ bool Executor::PickActiveMsg() {
   // finished.
   VLOG(1) << obj_.id() << ": pick nothing. msg buffer size "
           << recv_msgs_.size();
-  dag_cond_.wait(lk);
+  recv_queue_.Wait(ticket);
   return false;
 }
 
@@ -294,12 +296,8 @@ void Executor::ProcessActiveMsg() {
 }
 
 void Executor::Accept(Message* msg) {
-  {
-    Lock l(msg_mu_);
-    recv_msgs_.push_back(msg);
-    // VLOG(1) << obj_.id() << ": accept " << msg->ShortDebugString();
-  }
-  dag_cond_.notify_one();
+  // VLOG(1) << obj_.id() << ": accept " << msg->ShortDebugString();
+  recv_queue_.Push(msg);
 }
 
 
@@ -379,7 +377,7 @@ void Executor::AddNode(const Node& node) {
     }
     break;
   }
-  dag_cond_.notify_one();
+  recv_queue_.Wake();
 }
 
 } // namespace ps
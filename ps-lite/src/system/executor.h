@@ -1,6 +1,7 @@
 #pragma once
 #include "system/remote_node.h"
 #include "system/message.h"
+#include "base/lock_free_queue.h"
 namespace ps {
 
 const static NodeID kGroupPrefix  = "all_";
@@ -59,11 +60,14 @@ class Executor {
   void ProcessActiveMsg();
 
   // -- received messages --
+  // messages accepted but not moved into recv_msgs_ yet. it also wakes the
+  // processing thread when a received request is finished
+  LockFreeQueue<Message*> recv_queue_;
+  // messages waiting for their dependencies, only accessed by the processing
+  // thread
   std::list<Message*> recv_msgs_;
-  std::mutex msg_mu_;
   // the message is going to be processed or the last one be processed
   std::shared_ptr<Message> active_msg_, last_request_, last_response_;
-  std::condition_variable dag_cond_;
 
   // -- remote nodes --
   std::mutex node_mu_;
@@ -100,7 +104,7 @@ class Executor {
   std::unordered_map<int, ReqInfo> sent_reqs_;
 
   // the processing thread
-  bool done_ = false;
+  std::atomic<bool> done_{false};
   std::thread* thread_ = nullptr;
 };
 
@@ -31,7 +31,7 @@ void Postoffice::Run(int* argc, char*** argv) {
 void Postoffice::Send() {
   Message* msg;
   while (true) {
-    sending_queue_.wait_and_pop(msg);
+    sending_queue_.WaitAndPop(&msg);
     if (msg->terminate) break;
     size_t send_bytes = 0;
     manager_.van().Send(msg, &send_bytes);
@@ -1,7 +1,7 @@
 #pragma once
 #include "base/common.h"
 #include "system/message.h"
-#include "base/threadsafe_queue.h"
+#include "base/lock_free_queue.h"
 #include "system/manager.h"
 namespace ps {
 
@@ -26,7 +26,7 @@ class Postoffice {
    * @param msg it will be DELETE by system after sent successfully. so do NOT
    * delete it before
    */
-  void Queue(Message* msg) { sending_queue_.push(msg); }
+  void Queue(Message* msg) { sending_queue_.Push(msg); }
 
   Manager& manager() { return manager_; }
 
@@ -37,7 +37,7 @@ class Postoffice {
 
   std::unique_ptr<std::thread> recv_thread_;
   std::unique_ptr<std::thread> send_thread_;
-  ThreadsafeQueue<Message*> sending_queue_;
+  LockFreeQueue<Message*> sending_queue_;
 
   Manager manager_;
   DISALLOW_COPY_AND_ASSIGN(Postoffice);
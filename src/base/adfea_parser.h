@@ -8,6 +8,7 @@
 #include "data/parser.h"
 #include "data/strtonum.h"
 #include "dmlc/recordio.h"
+#include "base/chunk_parser.h"
 namespace dmlc {
 namespace data {
 
@@ -18,40 +19,28 @@ namespace data {
  *  <categorical feature 1> ... <categorical feature 26>
  */
 template <typename IndexType>
-class AdfeaParser : public ParserImpl<IndexType> {
+class AdfeaParser : public ChunkParser<IndexType> {
  public:
-  explicit AdfeaParser(InputSplit *source)
-      : bytes_read_(0), source_(source) { }
-  virtual ~AdfeaParser() {
-    delete source_;
-  }
+  /**
+   * @param nthreads the number of threads to parse a chunk
+   */
+  explicit AdfeaParser(InputSplit *source, int nthreads = 1)
+      : ChunkParser<IndexType>(source, nthreads) { }
+  virtual ~AdfeaParser() { }
 
-  virtual void BeforeFirst(void) {
-    source_->BeforeFirst();
-  }
-  virtual size_t BytesRead(void) const {
-    return bytes_read_;
-  }
-  virtual bool ParseNext(std::vector<RowBlockContainer<IndexType> > *data) {
-    InputSplit::Blob chunk;
-    if (!source_->NextChunk(&chunk)) return false;
-
-    CHECK(chunk.size != 0);
-    bytes_read_ += chunk.size;
-    data->resize(1);
-    RowBlockContainer<IndexType>& blk = (*data)[0];
-    blk.Clear();
+ protected:
+  virtual void ParseBlock(char *p, char *end,
+                          RowBlockContainer<IndexType> *out) {
+    RowBlockContainer<IndexType>& blk = *out;
     int i = 0;
-    char *p = reinterpret_cast<char*>(chunk.dptr);
-    char *end = p + chunk.size;
-    while (isspace(*p) && p != end) ++p;
+    while (p != end && isspace(*p)) ++p;
     while (p != end) {
 
       char *head = p;
-      while (isdigit(*p) && p != end) ++p;
+      while (p != end && isdigit(*p)) ++p;
       CHECK_NE(head, p);
 
-      if (*p == ':') {
+      if (p != end && *p == ':') {
         ++p;
         IndexType idx = (IndexType)strtoull(head, NULL, 10);
         if (sizeof(IndexType) == 8) {
@@ -60,7 +49,7 @@ class AdfeaParser : public ParserImpl<IndexType> {
         } else {
           // skip the group id
         }
-        while (isdigit(*p) && p != end) ++p;
+        while (p != end && isdigit(*p)) ++p;
         blk.index.push_back(idx);
       } else {
         // skip the lineid and the first count
@@ -75,19 +64,12 @@ class AdfeaParser : public ParserImpl<IndexType> {
         }
       }
 
-      while (isspace(*p) && p != end) ++p;
+      while (p != end && isspace(*p)) ++p;
     }
     if (blk.label.size() != 0) {
       blk.offset.push_back(blk.index.size());
     }
-    return true;
   }
-
- private:
-  // number of bytes readed
-  size_t bytes_read_;
-  // source split that provides the data
-  InputSplit *source_;
 };
 
 }  // namespace data
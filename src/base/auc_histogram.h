@@ -0,0 +1,57 @@
+/**
+ * @file   auc_histogram.h
+ * @brief  AUC over a fixed-bucket histogram of the predictions
+ */
+#pragma once
+#include <cmath>
+namespace dmlc {
+
+/**
+ * \brief The AUC of examples summarized by two histograms of their
+ * predictions, pos for the positive examples and neg for the negative ones,
+ * each with kBuckets counts over the margins in [-kRange, kRange).
+ *
+ * Histograms of different minibatches and workers are merged by summing them,
+ * so they can be a part of the progress the scheduler sums, and the AUC of
+ * all of them costs O(kBuckets). The pairs within a bucket count as half
+ * ordered, so the error is bounded by the fraction of such pairs. bench/auc_perf
+ * measures it against the sorted \ref BinClassEval::AUC, which is below 1e-4
+ * for normal margins with a standard deviation of .5 to 4.
+ */
+class AUCHistogram {
+ public:
+  /// \brief the number of buckets per histogram
+  static const int kBuckets = 512;
+
+  /**
+   * \brief the bucket of a margin, the ones out of the range are clamped. NaN,
+   * such as of a diverged model, goes to the bucket of margin 0, the same as a
+   * prediction that tells nothing
+   */
+  static int Bucket(double p) {
+    if (std::isnan(p)) return kBuckets / 2;
+    double b = std::floor((p + kRange) * (kBuckets / (2 * kRange)));
+    return b < 0 ? 0 : (b >= kBuckets ? kBuckets - 1 : (int)b);
+  }
+
+  /**
+   * \brief returns the AUC, 1 if all examples have the same label. As \ref
+   * BinClassEval::AUC, a value below .5 is flipped
+   */
+  static double AUC(const double* pos, const double* neg) {
+    double area = 0, cum_neg = 0, num_pos = 0;
+    for (int b = 0; b < kBuckets; ++b) {
+      area += pos[b] * (cum_neg + neg[b] * .5);
+      cum_neg += neg[b];
+      num_pos += pos[b];
+    }
+    if (num_pos == 0 || cum_neg == 0) return 1;
+    area /= num_pos * cum_neg;
+    return area < 0.5 ? 1 - area : area;
+  }
+
+ private:
+  static constexpr double kRange = 8;
+};
+
+}  // namespace dmlc
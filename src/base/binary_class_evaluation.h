@@ -2,6 +2,8 @@
 #include <algorithm>
 #include <dmlc/logging.h>
 #include <dmlc/omp.h>
+#include "base/fast_math.h"
+#include "base/auc_histogram.h"
 namespace dmlc {
 
 template <typename V>
@@ -37,6 +39,29 @@ class BinClassEval {
     return area < 0.5 ? 1 - area : area;
   }
 
+  /**
+   * \brief adds the predictions into the histograms pos and neg of \ref
+   * AUCHistogram, each with AUCHistogram::kBuckets counts. It is O(n), while
+   * \ref AUC sorts
+   */
+  void AddToAUCHistogram(double* pos, double* neg) {
+    const int nb = AUCHistogram::kBuckets;
+#pragma omp parallel num_threads(nt_)
+    {
+      std::vector<double> hist(2 * nb);
+#pragma omp for
+      for (size_t i = 0; i < size_; ++i) {
+        int b = AUCHistogram::Bucket(predict_[i]);
+        hist[label_[i] > 0 ? b : nb + b] += 1;
+      }
+#pragma omp critical
+      for (int b = 0; b < nb; ++b) {
+        pos[b] += hist[b];
+        neg[b] += hist[nb + b];
+      }
+    }
+  }
+
   V Accuracy(V threshold) {
     V correct = 0;
     size_t n = size_;
@@ -53,42 +78,63 @@ class BinClassEval {
   V LogLoss() {
     V loss = 0;
     size_t n = size_;
+    if (fastmath::UseLibm()) {
+#pragma omp parallel for reduction(+:loss) num_threads(nt_)
+      for (size_t i = 0; i < n; ++i) {
+        V y = label_[i] > 0;
+        V p = 1 / (1 + exp(- predict_[i]));
+        p = p < 1e-10 ? 1e-10 : p;
+        loss += y * log(p) + (1 - y) * log(1 - p);
+      }
+      return - loss;
+    }
+
+    // -log(p) = log(1 + exp(-predict)), -log(1-p) = log(1 + exp(predict)),
+    // and p is clipped at 1e-10 as above
+    std::vector<V> buf(n);
+    Margins(-1, buf.data());
+    fastmath::Log1pExp(buf.data(), buf.data(), n, nt_);
+    const V max_loss = 23.0258509;  // -log(1e-10)
 #pragma omp parallel for reduction(+:loss) num_threads(nt_)
     for (size_t i = 0; i < n; ++i) {
-      V y = label_[i] > 0;
-      V p = 1 / (1 + exp(- predict_[i]));
-      p = p < 1e-10 ? 1e-10 : p;
-      loss += y * log(p) + (1 - y) * log(1 - p);
+      loss += label_[i] > 0 ? std::min(buf[i], max_loss) : buf[i];
     }
-    return - loss;
+    return loss;
   }
 
   V LogitObjv() {
+    // log(1 + exp(-y * predict))
+    std::vector<V> buf(size_);
+    Margins(-1, buf.data());
+    fastmath::Log1pExp(buf.data(), buf.data(), size_, nt_);
     V objv = 0;
 #pragma omp parallel for reduction(+:objv) num_threads(nt_)
-    for (size_t i = 0; i < size_; ++i) {
-      V y = label_[i] > 0 ? 1 : -1;
-      V score = y * predict_[i];
-      if (score < -30)
-        objv += -score;
-      else if (score <= 30)
-        objv += log( 1 + exp( - score ));
-    }
+    for (size_t i = 0; i < size_; ++i) objv += buf[i];
     return objv;
   }
-  
+
   V Copc(){
     V clk = 0;
     V clk_exp = 0.0;
+    std::vector<V> prob(size_);
+    fastmath::Sigmoid(predict_, prob.data(), size_, nt_);
 #pragma omp parallel for reduction(+:clk,clk_exp) num_threads(nt_)
     for (size_t i = 0; i < size_; ++i) {
       if (label_[i] > 0) clk += 1;
-      clk_exp += 1.0 / ( 1.0 + exp( - predict_[i] ));
+      clk_exp += prob[i];
     }
     return clk / clk_exp;
   }
 
  private:
+  // m[i] = s * y[i] * predict[i] with y[i] in {-1, 1}
+  void Margins(V s, V* m) {
+#pragma omp parallel for num_threads(nt_)
+    for (size_t i = 0; i < size_; ++i) {
+      m[i] = (label_[i] > 0 ? s : -s) * predict_[i];
+    }
+  }
+
   V const* label_;
   V const* predict_;
   size_t size_;
@@ -0,0 +1,119 @@
+/**
+ * @file   cached_parser.h
+ * @brief  Caches the parsed data of a file part in a local CRB v2 file
+ */
+#pragma once
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <functional>
+#include <string>
+#include "data/parser.h"
+#include "base/crb_file.h"
+namespace dmlc {
+namespace data {
+
+/**
+ * \brief Returns the cache file of the k-th of n parts of \a uri in the
+ * directory \a dir, which is created if it does not exist.
+ *
+ * The name depends on the uri, the format and the index type, but not on the
+ * file content, so the directory should be removed once the data changes.
+ */
+template <typename IndexType>
+std::string CacheFile(const std::string& dir, const std::string& uri,
+                      const std::string& format, unsigned k, unsigned n) {
+  mkdir(dir.c_str(), 0755);
+  size_t pos = uri.find_last_of('/');
+  std::string name = pos == std::string::npos ? uri : uri.substr(pos + 1);
+  char hash[20];
+  snprintf(hash, sizeof(hash), "%016zx", std::hash<std::string>()(
+      uri + "\t" + format + "\t" + std::to_string(sizeof(IndexType))));
+  return dir + "/" + name + "-" + hash + "-" + std::to_string(k) + "-" +
+      std::to_string(n) + ".crb";
+}
+
+/**
+ * \brief Returns true if \a file is a complete cache file
+ */
+inline bool HasCacheFile(const std::string& file) {
+  struct stat st;
+  return stat(file.c_str(), &st) == 0 && CRBFile::IsCRBFile(file);
+}
+
+/**
+ * \brief Passes the blocks of a parser through and writes them into a cache
+ * file at the same time.
+ *
+ * The blocks are written into a temporary file, which is renamed to the cache
+ * file only after the whole part is read, so a cache file is always
+ * complete. Later passes read it by \ref CRBFileParser without parsing.
+ */
+template <typename IndexType>
+class CacheWriterParser : public ParserImpl<IndexType> {
+ public:
+  /**
+   * @param base the parser of the part, which is owned
+   * @param cache the cache file
+   */
+  CacheWriterParser(ParserImpl<IndexType>* base, const std::string& cache)
+      : base_(base), cache_(cache),
+        tmp_(cache + ".tmp." + std::to_string(getpid())) {
+    Open();
+  }
+  virtual ~CacheWriterParser() {
+    if (fo_) {
+      // not finished, drop the partial file
+      Close();
+      remove(tmp_.c_str());
+    }
+    delete base_;
+  }
+
+  virtual void BeforeFirst(void) {
+    base_->BeforeFirst();
+    // restart the cache file unless it is already done
+    if (fo_) { Close(); Open(); }
+  }
+  virtual size_t BytesRead(void) const {
+    return base_->BytesRead();
+  }
+
+ protected:
+  virtual bool ParseNext(std::vector<RowBlockContainer<IndexType> > *data) {
+    if (!base_->Next()) {
+      if (fo_) {
+        Close();
+        CHECK_EQ(rename(tmp_.c_str(), cache_.c_str()), 0)
+            << "failed to rename " << tmp_ << ": " << strerror(errno);
+      }
+      return false;
+    }
+    const auto& blk = base_->Value();
+    if (fo_) writer_->Write(blk);
+    data->resize(1); (*data)[0].Clear();
+    (*data)[0].Push(blk);
+    return true;
+  }
+
+ private:
+  void Open() {
+    fo_ = Stream::Create(tmp_.c_str(), "w");
+    writer_ = new CRBWriter(fo_, true);
+  }
+
+  void Close() {
+    writer_->Close();
+    delete writer_; writer_ = NULL;
+    delete fo_; fo_ = NULL;
+  }
+
+  ParserImpl<IndexType>* base_;
+  std::string cache_, tmp_;
+  // the temporary file being written, NULL if done
+  Stream* fo_ = NULL;
+  CRBWriter* writer_ = NULL;
+};
+
+}  // namespace data
+}  // namespace dmlc
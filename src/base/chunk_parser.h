@@ -0,0 +1,91 @@
+/**
+ * @file   chunk_parser.h
+ * @brief  The base of the text parsers which parse a chunk by multiple threads
+ */
+#pragma once
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "data/row_block.h"
+#include "data/parser.h"
+#include "dmlc/io.h"
+#include "dmlc/omp.h"
+namespace dmlc {
+namespace data {
+
+/**
+ * \brief Reads a chunk from an InputSplit, cuts it into \a nthreads pieces at
+ * line boundaries, and parses the pieces in parallel into separate
+ * RowBlockContainers, as LibSVMParser does. A subclass only parses the lines
+ * of a piece by \ref ParseBlock.
+ */
+template <typename IndexType>
+class ChunkParser : public ParserImpl<IndexType> {
+ public:
+  ChunkParser(InputSplit *source, int nthreads)
+      : bytes_read_(0), source_(source), nt_(std::max(nthreads, 1)) { }
+  virtual ~ChunkParser() {
+    delete source_;
+  }
+
+  virtual void BeforeFirst(void) {
+    source_->BeforeFirst();
+  }
+  virtual size_t BytesRead(void) const {
+    return bytes_read_;
+  }
+
+  virtual bool ParseNext(std::vector<RowBlockContainer<IndexType> > *data) {
+    InputSplit::Blob chunk;
+    if (!source_->NextChunk(&chunk)) return false;
+
+    CHECK(chunk.size != 0);
+    bytes_read_ += chunk.size;
+    char *head = reinterpret_cast<char*>(chunk.dptr);
+    char *end = head + chunk.size;
+
+    // piece i is [pos_[i], pos_[i+1]), each one but the last ends right after
+    // a newline
+    pos_.resize(nt_ + 1);
+    pos_[0] = head;
+    pos_[nt_] = end;
+    for (int i = 1; i < nt_; ++i) {
+      char *p = std::max(head + chunk.size * i / nt_, pos_[i-1]);
+      char *q = Find(p, end, '\n');
+      pos_[i] = q == end ? end : q + 1;
+    }
+
+    data->resize(nt_);
+#pragma omp parallel for num_threads(nt_)
+    for (int i = 0; i < nt_; ++i) {
+      (*data)[i].Clear();
+      if (pos_[i] != pos_[i+1]) ParseBlock(pos_[i], pos_[i+1], &(*data)[i]);
+    }
+    return true;
+  }
+
+ protected:
+  /**
+   * \brief parses the lines in [begin, end) into an empty container
+   */
+  virtual void ParseBlock(char *begin, char *end,
+                          RowBlockContainer<IndexType> *out) = 0;
+
+  /// \brief returns the first c in [p, end), or end if not found
+  static inline char* Find(char *p, char *end, int c) {
+    char *q = (char*)memchr(p, c, end - p);
+    return q ? q : end;
+  }
+
+ private:
+  // number of bytes readed
+  size_t bytes_read_;
+  // source split that provides the data
+  InputSplit *source_;
+  // number of threads
+  int nt_;
+  std::vector<char*> pos_;
+};
+
+}  // namespace data
+}  // namespace dmlc
@@ -0,0 +1,300 @@
+/**
+ * @file   crb_file.h
+ * @brief  CRB v2: an indexed file of compressed row blocks, read through mmap
+ */
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "lz4.h"
+#include "dmlc/io.h"
+#include "data/row_block.h"
+#include "io/filesys.h"
+#include "base/mmap_file.h"
+namespace dmlc {
+namespace data {
+
+/**
+ * \brief The layout of a CRB v2 file
+ *
+ *   block 0, block 1, ..., block n-1, index, footer
+ *
+ * A block is a \ref BlockHeader followed by the columns label, offset, index,
+ * value and weight. Each column is absent, raw or LZ4 compressed, and starts
+ * at a multiple of 8 bytes from the file beginning, so a raw column can be
+ * used in place. The offsets of a block start from 0. The index has an \ref
+ * IndexEntry per block, and the \ref Footer ends the file.
+ */
+namespace crb {
+
+static const uint32_t kBlockMagic = 0x4b4c4243;   // "CBLK"
+static const uint32_t kFooterMagic = 0x32425243;  // "CRB2"
+static const uint32_t kVersion = 2;
+
+enum Codec { kAbsent = 0, kRaw = 1, kLZ4 = 2 };
+enum Column { kLabel = 0, kOffset, kIndex, kValue, kWeight, kNumColumns };
+
+struct BlockHeader {
+  uint32_t magic;
+  uint32_t index_bytes;  // sizeof(IndexType)
+  uint64_t num_rows;
+  uint64_t nnz;
+  uint32_t codec[kNumColumns];
+  uint32_t reserved;
+  uint64_t bytes[kNumColumns];  // the stored size of each column
+};
+
+struct IndexEntry {
+  uint64_t offset;  // the position of the block in the file
+  uint64_t num_rows;
+};
+
+struct Footer {
+  uint64_t index_offset;
+  uint64_t num_blocks;
+  uint64_t num_rows;
+  uint32_t version;
+  uint32_t magic;
+};
+
+inline size_t Align(size_t n) { return (n + 7) / 8 * 8; }
+
+}  // namespace crb
+
+/**
+ * \brief Writes row blocks into a CRB v2 file. \ref Close must be called after
+ * the last block to write the index.
+ */
+class CRBWriter {
+ public:
+  /**
+   * @param fo the output stream, which is not owned
+   * @param compress compress a column by LZ4 if it becomes smaller. Otherwise
+   * columns are stored raw, and readers use them without copying.
+   */
+  explicit CRBWriter(Stream* fo, bool compress = false)
+      : fo_(CHECK_NOTNULL(fo)), compress_(compress) { }
+  ~CRBWriter() { CHECK(closed_ || index_.empty()) << "call Close()"; }
+
+  /// \brief appends a block, the value column is dropped if all ones
+  template <typename IndexType>
+  void Write(RowBlock<IndexType> blk) {
+    CHECK(!closed_);
+    if (blk.size == 0) return;
+    size_t nnz = blk.offset[blk.size] - blk.offset[0];
+    if (blk.value) {
+      bool bin = true;
+      for (size_t i = 0; i < nnz; ++i) {
+        if (blk.value[i] != 1) { bin = false; break; }
+      }
+      if (bin) blk.value = NULL;
+    }
+    // offsets start from 0
+    if (blk.offset[0] != 0) {
+      offset_.resize(blk.size + 1);
+      for (size_t i = 0; i <= blk.size; ++i) {
+        offset_[i] = blk.offset[i] - blk.offset[0];
+      }
+      blk.index += blk.offset[0];
+      if (blk.value) blk.value += blk.offset[0];
+      blk.offset = offset_.data();
+    }
+
+    crb::BlockHeader h;
+    memset(&h, 0, sizeof(h));
+    h.magic = crb::kBlockMagic;
+    h.index_bytes = sizeof(IndexType);
+    h.num_rows = blk.size;
+    h.nnz = nnz;
+    const char* col[] = {
+      (const char*)blk.label, (const char*)blk.offset, (const char*)blk.index,
+      (const char*)blk.value, (const char*)blk.weight};
+    size_t len[] = {
+      blk.size * sizeof(real_t), (blk.size + 1) * sizeof(size_t),
+      nnz * sizeof(IndexType), nnz * sizeof(real_t), blk.size * sizeof(real_t)};
+
+    buf_.assign(crb::Align(sizeof(h)), 0);
+    for (int c = 0; c < crb::kNumColumns; ++c) {
+      if (col[c] == NULL || len[c] == 0) continue;
+      size_t start = buf_.size();
+      h.codec[c] = crb::kRaw;
+      if (compress_ && len[c] <= LZ4_MAX_INPUT_SIZE) {
+        int bound = LZ4_compressBound(len[c]);
+        buf_.resize(start + bound);
+        int n = LZ4_compress_default(col[c], &buf_[start], len[c], bound);
+        if (n > 0 && (size_t)n < len[c]) {
+          h.codec[c] = crb::kLZ4;
+          buf_.resize(start + n);
+        }
+      }
+      if (h.codec[c] == crb::kRaw) {
+        buf_.resize(start);
+        buf_.append(col[c], len[c]);
+      }
+      h.bytes[c] = buf_.size() - start;
+      buf_.resize(crb::Align(buf_.size()), 0);
+    }
+    memcpy(&buf_[0], &h, sizeof(h));
+
+    index_.push_back(crb::IndexEntry{pos_, blk.size});
+    fo_->Write(buf_.data(), buf_.size());
+    pos_ += buf_.size();
+    num_rows_ += blk.size;
+  }
+
+  /// \brief writes the index and the footer
+  void Close() {
+    CHECK(!closed_);
+    crb::Footer f;
+    memset(&f, 0, sizeof(f));
+    f.index_offset = pos_;
+    f.num_blocks = index_.size();
+    f.num_rows = num_rows_;
+    f.version = crb::kVersion;
+    f.magic = crb::kFooterMagic;
+    fo_->Write(index_.data(), index_.size() * sizeof(crb::IndexEntry));
+    fo_->Write(&f, sizeof(f));
+    closed_ = true;
+  }
+
+ private:
+  Stream* fo_;
+  bool compress_;
+  bool closed_ = false;
+  uint64_t pos_ = 0;
+  uint64_t num_rows_ = 0;
+  std::vector<crb::IndexEntry> index_;
+  std::string buf_;
+  std::vector<size_t> offset_;
+};
+
+/**
+ * \brief Reads a CRB v2 file through mmap. Blocks are accessed by their
+ * position in the index, and raw columns are returned in place.
+ */
+class CRBFile {
+ public:
+  explicit CRBFile(const std::string& uri) : file_(uri) {
+    CHECK_GE(file_.size(), sizeof(footer_)) << uri << " is not a CRB v2 file";
+    memcpy(&footer_, file_.data() + file_.size() - sizeof(footer_),
+           sizeof(footer_));
+    CHECK(ValidFooter(footer_, file_.size())) << uri << " is not a CRB v2 file";
+    index_ = (const crb::IndexEntry*)(file_.data() + footer_.index_offset);
+  }
+
+  /**
+   * \brief Returns true if \a uri is a CRB v2 file. Only the footer is read.
+   */
+  static bool IsCRBFile(const std::string& uri) {
+    io::URI path(uri.c_str());
+    size_t size = io::FileSystem::GetInstance(path.protocol)->GetPathInfo(
+        path).size;
+    if (size < sizeof(crb::Footer)) return false;
+    SeekStream* fi = SeekStream::CreateForRead(uri.c_str(), true);
+    if (fi == NULL) return false;
+    crb::Footer f;
+    fi->Seek(size - sizeof(f));
+    bool ret = fi->Read(&f, sizeof(f)) == sizeof(f) && ValidFooter(f, size);
+    delete fi;
+    return ret;
+  }
+
+  size_t num_blocks() const { return footer_.num_blocks; }
+  size_t num_rows() const { return footer_.num_rows; }
+  size_t block_rows(size_t i) const { return index_[i].num_rows; }
+  /// \brief the size of block i in the file
+  size_t block_bytes(size_t i) const {
+    return (i + 1 < num_blocks() ? index_[i+1].offset : footer_.index_offset)
+        - index_[i].offset;
+  }
+
+  /**
+   * \brief Returns the blocks [begin, end) of the k-th of n parts. The parts
+   * have about the same number of rows.
+   */
+  void Part(unsigned k, unsigned n, size_t* begin, size_t* end) const {
+    CHECK_LT(k, n);
+    *begin = FirstBlock((double)num_rows() * k / n);
+    *end = FirstBlock((double)num_rows() * (k + 1) / n);
+  }
+
+  /// \brief hints that the blocks [begin, end) will be read soon
+  void WillNeed(size_t begin, size_t end) const {
+    if (begin >= end) return;
+    size_t off = index_[begin].offset;
+    file_.WillNeed(off, index_[end-1].offset + block_bytes(end-1) - off);
+  }
+
+  /**
+   * \brief Gets block i
+   *
+   * @param blk the block. A raw column points into the mapping, a compressed
+   * one points into \a buf. It is valid until the next Get with the same buf.
+   * @param buf the buffer for the decompressed columns
+   */
+  template <typename IndexType>
+  void Get(size_t i, RowBlock<IndexType>* blk,
+           RowBlockContainer<IndexType>* buf) const {
+    CHECK_LT(i, num_blocks());
+    const char* p = file_.data() + index_[i].offset;
+    crb::BlockHeader h;
+    memcpy(&h, p, sizeof(h));
+    CHECK_EQ(h.magic, crb::kBlockMagic) << "corrupted block " << i;
+    CHECK_EQ(h.index_bytes, sizeof(IndexType)) << "wrong index type";
+    p += crb::Align(sizeof(h));
+    size_t n = h.num_rows, nnz = h.nnz;
+    blk->size = n;
+    blk->label = GetColumn(h, crb::kLabel, n, &p, &buf->label);
+    blk->offset = GetColumn(h, crb::kOffset, n + 1, &p, &buf->offset);
+    blk->index = GetColumn(h, crb::kIndex, nnz, &p, &buf->index);
+    blk->value = GetColumn(h, crb::kValue, nnz, &p, &buf->value);
+    blk->weight = GetColumn(h, crb::kWeight, n, &p, &buf->weight);
+    CHECK_LE(p, file_.data() + index_[i].offset + block_bytes(i));
+    CHECK(blk->offset != NULL && blk->offset[n] == nnz) << "corrupted block";
+  }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(CRBFile);
+
+  // f is read from the end of a file with size bytes
+  static bool ValidFooter(const crb::Footer& f, size_t size) {
+    return f.magic == crb::kFooterMagic && f.version == crb::kVersion &&
+        f.index_offset + f.num_blocks * sizeof(crb::IndexEntry) + sizeof(f)
+        == size;
+  }
+
+  // the first block whose first row >= row
+  size_t FirstBlock(double row) const {
+    double r = 0;
+    for (size_t i = 0; i < num_blocks(); ++i) {
+      if (r >= row) return i;
+      r += index_[i].num_rows;
+    }
+    return num_blocks();
+  }
+
+  template <typename T>
+  static const T* GetColumn(const crb::BlockHeader& h, int c, size_t len,
+                            const char** p, std::vector<T>* buf) {
+    if (h.codec[c] == crb::kAbsent) return NULL;
+    const char* src = *p;
+    *p += crb::Align(h.bytes[c]);
+    if (h.codec[c] == crb::kRaw) {
+      CHECK_EQ(h.bytes[c], len * sizeof(T));
+      return (const T*)src;
+    }
+    CHECK_EQ(h.codec[c], (uint32_t)crb::kLZ4);
+    buf->resize(len);
+    int size = len * sizeof(T);
+    CHECK_EQ(size, LZ4_decompress_safe(src, (char*)buf->data(), h.bytes[c], size));
+    return buf->data();
+  }
+
+  MappedFile file_;
+  crb::Footer footer_;
+  const crb::IndexEntry* index_;
+};
+
+}  // namespace data
+}  // namespace dmlc
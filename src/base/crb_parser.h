@@ -6,6 +6,7 @@
 #include "data/parser.h"
 #include "dmlc/recordio.h"
 #include "base/compressed_row_block.h"
+#include "base/crb_file.h"
 namespace dmlc {
 namespace data {
 
@@ -46,5 +47,57 @@ class CRBParser : public ParserImpl<IndexType> {
   InputSplit *source_;
 };
 
+/**
+ * \brief parser for CRB v2 files, see \ref CRBFile.
+ *
+ * It jumps to the blocks of its part by the index, and returns the raw columns
+ * in place without copying, so it needs no reading thread.
+ */
+template <typename IndexType>
+class CRBFileParser : public ParserImpl<IndexType> {
+ public:
+  CRBFileParser(const std::string& uri, unsigned part_index,
+                unsigned num_parts) : file_(uri) {
+    file_.Part(part_index, num_parts, &begin_, &end_);
+    BeforeFirst();
+  }
+  virtual ~CRBFileParser() { }
+
+  virtual void BeforeFirst(void) {
+    cur_ = begin_;
+    bytes_read_ = 0;
+    file_.WillNeed(begin_, end_);
+  }
+  virtual size_t BytesRead(void) const {
+    return bytes_read_;
+  }
+
+  virtual bool Next(void) {
+    if (cur_ == end_) return false;
+    bytes_read_ += file_.block_bytes(cur_);
+    file_.Get(cur_++, &this->block_, &buf_);
+    return true;
+  }
+
+ protected:
+  virtual bool ParseNext(std::vector<RowBlockContainer<IndexType> > *data) {
+    if (cur_ == end_) return false;
+    bytes_read_ += file_.block_bytes(cur_);
+    RowBlock<IndexType> blk;
+    file_.Get(cur_++, &blk, &buf_);
+    data->resize(1); (*data)[0].Clear();
+    (*data)[0].Push(blk);
+    return true;
+  }
+
+ private:
+  CRBFile file_;
+  // the blocks of this part and the next one to read
+  size_t begin_, end_, cur_;
+  size_t bytes_read_;
+  // the decompressed columns of the current block
+  RowBlockContainer<IndexType> buf_;
+};
+
 } // namespace data
 } // namespace dmlc
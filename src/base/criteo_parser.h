@@ -10,6 +10,7 @@
 #include "data/parser.h"
 #include "data/strtonum.h"
 #include "dmlc/recordio.h"
+#include "base/chunk_parser.h"
 namespace dmlc {
 namespace data {
 
@@ -20,35 +21,25 @@ namespace data {
  *  <categorical feature 1> ... <categorical feature 26>
  */
 template <typename IndexType>
-class CriteoParser : public ParserImpl<IndexType> {
+class CriteoParser : public ChunkParser<IndexType> {
  public:
-  explicit CriteoParser(InputSplit *source, bool is_train)
-      : bytes_read_(0), source_(source), is_train_(is_train) {
-  }
-  virtual ~CriteoParser() {
-    delete source_;
+  /**
+   * @param nthreads the number of threads to parse a chunk
+   */
+  explicit CriteoParser(InputSplit *source, bool is_train, int nthreads = 1)
+      : ChunkParser<IndexType>(source, nthreads), is_train_(is_train) {
   }
+  virtual ~CriteoParser() { }
 
-  virtual void BeforeFirst(void) {
-    source_->BeforeFirst();
-  }
-  virtual size_t BytesRead(void) const {
-    return bytes_read_;
-  }
-  virtual bool ParseNext(std::vector<RowBlockContainer<IndexType> > *data) {
-    InputSplit::Blob chunk;
-    if (!source_->NextChunk(&chunk)) return false;
+ protected:
+  using ChunkParser<IndexType>::Find;
 
-    CHECK(chunk.size != 0);
-    bytes_read_ += chunk.size;
-    char *p = reinterpret_cast<char*>(chunk.dptr);
-    char *end = p + chunk.size;
-    data->resize(1);
-    RowBlockContainer<IndexType>& blk = (*data)[0];
-    blk.Clear();
+  virtual void ParseBlock(char *p, char *end,
+                          RowBlockContainer<IndexType> *out) {
+    RowBlockContainer<IndexType>& blk = *out;
     char *pp = p;
     while (p != end) {
-      while (*p == '\r' || *p == '\n') ++p;
+      while (p != end && (*p == '\r' || *p == '\n')) ++p;
       if (p == end) break;
 
       // parse label
@@ -85,21 +76,9 @@ class CriteoParser : public ParserImpl<IndexType> {
       }
       blk.offset.push_back(blk.index.size());
     }
-    return true;
   }
 
  private:
-
-  // implement strchr
-  inline char* Find(char* p, char* end, int c) {
-    while (p != end && *p != c) ++p;
-    return p;
-  }
-
-  // number of bytes readed
-  size_t bytes_read_;
-  // source split that provides the data
-  InputSplit *source_;
   bool is_train_;
 };
 
@@ -0,0 +1,294 @@
+/**
+ * @file   fast_math.h
+ * @brief  SIMD exp, log(1+exp(x)) and sigmoid over arrays, used by the losses
+ * and the evaluation
+ */
+#pragma once
+#include <stdint.h>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <type_traits>
+#include "dmlc/omp.h"
+#include "base/spmm_simd.h"  // for SimdLevel
+namespace dmlc {
+namespace fastmath {
+
+/**
+ * \brief use the exp and log of libm instead of the SIMD approximations. The
+ * results are then the same as the losses computed before the approximations
+ * were added. false in default
+ */
+inline bool& UseLibm() {
+  static bool libm = false;
+  return libm;
+}
+
+/// \brief y[i] = f(x[i]) for i in [0, n). x and y can be the same
+typedef void (*MapKernel)(const float* x, float* y, size_t n);
+
+/// \brief the kernels of a simd level
+struct Kernels {
+  MapKernel exp;
+  MapKernel log1pexp;
+  MapKernel sigmoid;
+};
+
+/**
+ * The operations used by the kernels, in addition to the ones of spmm, on a
+ * register of kWidth floats. As in spmm_simd.h, every function carries the
+ * target attribute of the kernels using it.
+ */
+struct ScalarOp {
+  typedef float Vec;
+  static const int kWidth = 1;
+  static inline Vec Set1(float a) { return a; }
+  static inline Vec Load(const float* p) { return *p; }
+  static inline void Store(float* p, Vec a) { *p = a; }
+  static inline Vec Add(Vec a, Vec b) { return a + b; }
+  static inline Vec Sub(Vec a, Vec b) { return a - b; }
+  static inline Vec Mul(Vec a, Vec b) { return a * b; }
+  static inline Vec Div(Vec a, Vec b) { return a / b; }
+  static inline Vec Fma(Vec a, Vec b, Vec c) { return a * b + c; }
+  static inline Vec Min(Vec a, Vec b) { return a < b ? a : b; }
+  static inline Vec Max(Vec a, Vec b) { return a > b ? a : b; }
+  static inline Vec Floor(Vec a) { return std::floor(a); }
+  // 2^n for an integral n in [-126, 127]
+  static inline Vec Pow2n(Vec n) {
+    int32_t i = ((int32_t)n + 127) << 23;
+    float a; memcpy(&a, &i, 4); return a;
+  }
+  // the unbiased exponent of a positive normal a, namely floor(log2(a))
+  static inline Vec Exponent(Vec a) {
+    int32_t i; memcpy(&i, &a, 4);
+    return (float)((i >> 23) - 127);
+  }
+};
+
+#ifdef DMLC_SPMM_X86
+struct AVX2MathOp {
+  typedef __m256 Vec;
+  static const int kWidth = 8;
+  DMLC_SPMM_OP(DMLC_SPMM_AVX2) Vec Set1(float a) { return _mm256_set1_ps(a); }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX2) Vec Load(const float* p) { return _mm256_loadu_ps(p); }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX2) void Store(float* p, Vec a) { _mm256_storeu_ps(p, a); }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX2) Vec Add(Vec a, Vec b) { return _mm256_add_ps(a, b); }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX2) Vec Sub(Vec a, Vec b) { return _mm256_sub_ps(a, b); }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX2) Vec Mul(Vec a, Vec b) { return _mm256_mul_ps(a, b); }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX2) Vec Div(Vec a, Vec b) { return _mm256_div_ps(a, b); }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX2) Vec Fma(Vec a, Vec b, Vec c) {
+    return _mm256_fmadd_ps(a, b, c);
+  }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX2) Vec Min(Vec a, Vec b) { return _mm256_min_ps(a, b); }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX2) Vec Max(Vec a, Vec b) { return _mm256_max_ps(a, b); }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX2) Vec Floor(Vec a) { return _mm256_floor_ps(a); }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX2) Vec Pow2n(Vec n) {
+    __m256i i = _mm256_add_epi32(_mm256_cvttps_epi32(n), _mm256_set1_epi32(127));
+    return _mm256_castsi256_ps(_mm256_slli_epi32(i, 23));
+  }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX2) Vec Exponent(Vec a) {
+    __m256i i = _mm256_srli_epi32(_mm256_castps_si256(a), 23);
+    return _mm256_cvtepi32_ps(_mm256_sub_epi32(i, _mm256_set1_epi32(127)));
+  }
+};
+
+struct AVX512MathOp {
+  typedef __m512 Vec;
+  static const int kWidth = 16;
+  DMLC_SPMM_OP(DMLC_SPMM_AVX512) Vec Set1(float a) { return _mm512_set1_ps(a); }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX512) Vec Load(const float* p) { return _mm512_loadu_ps(p); }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX512) void Store(float* p, Vec a) { _mm512_storeu_ps(p, a); }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX512) Vec Add(Vec a, Vec b) { return _mm512_add_ps(a, b); }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX512) Vec Sub(Vec a, Vec b) { return _mm512_sub_ps(a, b); }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX512) Vec Mul(Vec a, Vec b) { return _mm512_mul_ps(a, b); }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX512) Vec Div(Vec a, Vec b) { return _mm512_div_ps(a, b); }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX512) Vec Fma(Vec a, Vec b, Vec c) {
+    return _mm512_fmadd_ps(a, b, c);
+  }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX512) Vec Min(Vec a, Vec b) { return _mm512_min_ps(a, b); }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX512) Vec Max(Vec a, Vec b) { return _mm512_max_ps(a, b); }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX512) Vec Floor(Vec a) {
+    return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+  }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX512) Vec Pow2n(Vec n) {
+    __m512i i = _mm512_add_epi32(_mm512_cvttps_epi32(n), _mm512_set1_epi32(127));
+    return _mm512_castsi512_ps(_mm512_slli_epi32(i, 23));
+  }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX512) Vec Exponent(Vec a) {
+    __m512i i = _mm512_srli_epi32(_mm512_castps_si512(a), 23);
+    return _mm512_cvtepi32_ps(_mm512_sub_epi32(i, _mm512_set1_epi32(127)));
+  }
+};
+#endif  // DMLC_SPMM_X86
+
+/// \brief y = F(x) for the full registers of x, and the tail through a buffer
+#define DMLC_FASTMATH_MAP(F)                                            \
+  size_t i = 0;                                                         \
+  for (; i + Op::kWidth <= n; i += Op::kWidth) {                        \
+    Op::Store(y + i, F(Op::Load(x + i)));                               \
+  }                                                                     \
+  if (i < n) {                                                          \
+    float buf[Op::kWidth] = {0};                                        \
+    memcpy(buf, x + i, (n - i) * sizeof(float));                       \
+    Op::Store(buf, F(Op::Load(buf)));                                   \
+    memcpy(y + i, buf, (n - i) * sizeof(float));                        \
+  }
+
+/**
+ * \brief defines Exp##NAME<Op>, Log1pExp##NAME<Op> and Sigmoid##NAME<Op>
+ * compiled with the function attribute TARGET.
+ *
+ * exp is the one of cephes: x = n ln2 + r with |r| <= ln2/2, and exp(x) =
+ * 2^n exp(r) with a degree 7 polynomial of r. The input is clamped into
+ * [-87.3, 88], so it never returns 0 or inf. Its relative error is below
+ * 3e-7.
+ *
+ * log1p(t) for t in [0, 1] writes u = 1 + t = 2^e m with m in [1/sqrt2,
+ * sqrt2), and log(m) = 2 atanh(s) with s = (m-1)/(m+1), |s| < 0.172, in a
+ * series of s^2 up to s^8. The rounding of u is then corrected by (t -
+ * (u-1))/u. log(1+exp(x)) is max(x, 0) + log1p(exp(-|x|)), whose absolute
+ * error is below 2e-7 plus the relative error of max(x, 0).
+ */
+#define DMLC_FASTMATH_DEFINE_KERNELS(NAME, TARGET)                      \
+  template <typename Op>                                                \
+  static inline TARGET __attribute__((always_inline))                   \
+  typename Op::Vec ExpV##NAME(typename Op::Vec x) {                     \
+    typedef typename Op::Vec Vec;                                       \
+    x = Op::Min(Op::Max(x, Op::Set1(-87.3f)), Op::Set1(88.0f));         \
+    Vec n = Op::Floor(Op::Fma(x, Op::Set1(1.44269504088896341f),        \
+                              Op::Set1(.5f)));                          \
+    Vec r = Op::Fma(n, Op::Set1(-0.693359375f), x);                     \
+    r = Op::Fma(n, Op::Set1(2.12194440e-4f), r);                        \
+    Vec p = Op::Set1(1.9875691500e-4f);                                 \
+    p = Op::Fma(p, r, Op::Set1(1.3981999507e-3f));                      \
+    p = Op::Fma(p, r, Op::Set1(8.3334519073e-3f));                      \
+    p = Op::Fma(p, r, Op::Set1(4.1665795894e-2f));                      \
+    p = Op::Fma(p, r, Op::Set1(1.6666665459e-1f));                      \
+    p = Op::Fma(p, r, Op::Set1(5.0000001201e-1f));                      \
+    p = Op::Fma(p, Op::Mul(r, r), Op::Add(r, Op::Set1(1)));             \
+    return Op::Mul(p, Op::Pow2n(n));                                    \
+  }                                                                     \
+                                                                        \
+  /* t in [0, 1] */                                                     \
+  template <typename Op>                                                \
+  static inline TARGET __attribute__((always_inline))                   \
+  typename Op::Vec Log1pV##NAME(typename Op::Vec t) {                   \
+    typedef typename Op::Vec Vec;                                       \
+    Vec one = Op::Set1(1);                                              \
+    Vec u = Op::Add(one, t);                                            \
+    Vec e = Op::Exponent(Op::Mul(u, Op::Set1(1.41421356237309505f)));   \
+    Vec m = Op::Mul(u, Op::Pow2n(Op::Sub(Op::Set1(0), e)));             \
+    Vec s = Op::Div(Op::Sub(m, one), Op::Add(m, one));                  \
+    Vec z = Op::Mul(s, s);                                              \
+    Vec q = Op::Set1(1.f / 9);                                          \
+    q = Op::Fma(q, z, Op::Set1(1.f / 7));                               \
+    q = Op::Fma(q, z, Op::Set1(1.f / 5));                               \
+    q = Op::Fma(q, z, Op::Set1(1.f / 3));                               \
+    q = Op::Fma(q, z, one);                                             \
+    Vec log_u = Op::Fma(e, Op::Set1(0.693147180559945309f),             \
+                        Op::Mul(Op::Add(s, s), q));                     \
+    Vec c = Op::Div(Op::Sub(t, Op::Sub(u, one)), u);                    \
+    return Op::Add(log_u, c);                                           \
+  }                                                                     \
+                                                                        \
+  template <typename Op>                                                \
+  static inline TARGET __attribute__((always_inline))                   \
+  typename Op::Vec Log1pExpV##NAME(typename Op::Vec x) {                \
+    typename Op::Vec neg_abs = Op::Min(x, Op::Sub(Op::Set1(0), x));     \
+    return Op::Add(Op::Max(x, Op::Set1(0)),                             \
+                   Log1pV##NAME<Op>(ExpV##NAME<Op>(neg_abs)));          \
+  }                                                                     \
+                                                                        \
+  template <typename Op>                                                \
+  static inline TARGET __attribute__((always_inline))                   \
+  typename Op::Vec SigmoidV##NAME(typename Op::Vec x) {                 \
+    typename Op::Vec one = Op::Set1(1);                                 \
+    return Op::Div(one, Op::Add(one, ExpV##NAME<Op>(                    \
+        Op::Sub(Op::Set1(0), x))));                                     \
+  }                                                                     \
+                                                                        \
+  template <typename Op> TARGET                                         \
+  void Exp##NAME(const float* x, float* y, size_t n) {                  \
+    DMLC_FASTMATH_MAP(ExpV##NAME<Op>)                                   \
+  }                                                                     \
+  template <typename Op> TARGET                                         \
+  void Log1pExp##NAME(const float* x, float* y, size_t n) {             \
+    DMLC_FASTMATH_MAP(Log1pExpV##NAME<Op>)                              \
+  }                                                                     \
+  template <typename Op> TARGET                                         \
+  void Sigmoid##NAME(const float* x, float* y, size_t n) {              \
+    DMLC_FASTMATH_MAP(SigmoidV##NAME<Op>)                               \
+  }
+
+DMLC_FASTMATH_DEFINE_KERNELS(Generic, )
+#ifdef DMLC_SPMM_X86
+DMLC_FASTMATH_DEFINE_KERNELS(AVX2, DMLC_SPMM_AVX2)
+DMLC_FASTMATH_DEFINE_KERNELS(AVX512, DMLC_SPMM_AVX512)
+#endif
+
+/**
+ * \brief returns the kernels of a simd level, by default the one used by
+ * spmm. A higher level than the CPU supports is lowered
+ */
+inline const Kernels* GetKernels(
+    spmm::SimdLevel level = spmm::ActiveSimdLevel()) {
+  static const Kernels generic = {
+    ExpGeneric<ScalarOp>, Log1pExpGeneric<ScalarOp>, SigmoidGeneric<ScalarOp>};
+#ifdef DMLC_SPMM_X86
+  static const Kernels avx2 = {
+    ExpAVX2<AVX2MathOp>, Log1pExpAVX2<AVX2MathOp>, SigmoidAVX2<AVX2MathOp>};
+  static const Kernels avx512 = {
+    ExpAVX512<AVX512MathOp>, Log1pExpAVX512<AVX512MathOp>,
+    SigmoidAVX512<AVX512MathOp>};
+  static const spmm::SimdLevel best = spmm::DetectSimdLevel();
+  if (level > best) level = best;
+  if (level == spmm::kAVX512) return &avx512;
+  if (level == spmm::kAVX2) return &avx2;
+#endif
+  return &generic;
+}
+
+/**
+ * \brief y[i] = f(x[i]) with nt threads, using the kernel if V is float and
+ * libm is not asked for, otherwise the scalar f
+ */
+template <typename V, typename F>
+inline void Map(const V* x, V* y, size_t n, int nt, MapKernel kernel, F f) {
+  if (std::is_same<V, float>::value && !UseLibm()) {
+    const float* xf = reinterpret_cast<const float*>(x);
+    float* yf = reinterpret_cast<float*>(y);
+    // keeps the segments a multiple of 16, the widest register
+    size_t seg = (n / std::max(nt, 1) + 16) / 16 * 16;
+#pragma omp parallel for num_threads(nt)
+    for (size_t i = 0; i < n; i += seg) kernel(xf + i, yf + i, std::min(seg, n - i));
+    return;
+  }
+#pragma omp parallel for num_threads(nt)
+  for (size_t i = 0; i < n; ++i) y[i] = f(x[i]);
+}
+
+/** \brief y = exp(x) */
+template <typename V>
+inline void Exp(const V* x, V* y, size_t n, int nt = 1) {
+  Map(x, y, n, nt, GetKernels()->exp, [](V a) { return (V)exp(a); });
+}
+
+/**
+ * \brief y = log(1 + exp(x)), the logistic loss of margin -x. The libm one is
+ * x for x > 30 and 0 for x < -30
+ */
+template <typename V>
+inline void Log1pExp(const V* x, V* y, size_t n, int nt = 1) {
+  Map(x, y, n, nt, GetKernels()->log1pexp, [](V a) {
+      return a > 30 ? a : (a < -30 ? (V)0 : (V)log(1 + exp(a))); });
+}
+
+/** \brief y = 1 / (1 + exp(-x)) */
+template <typename V>
+inline void Sigmoid(const V* x, V* y, size_t n, int nt = 1) {
+  Map(x, y, n, nt, GetKernels()->sigmoid, [](V a) {
+      return (V)(1 / (1 + exp(-a))); });
+}
+
+}  // namespace fastmath
+}  // namespace dmlc
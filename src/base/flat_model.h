@@ -0,0 +1,284 @@
+/**
+ * @file   flat_model.h
+ * @brief  A flat, memory-mappable model file for serving
+ */
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <numeric>
+#include <string>
+#include <vector>
+#include "dmlc/io.h"
+#include "dmlc/logging.h"
+#include "base/mmap_file.h"
+namespace dmlc {
+
+/**
+ * \brief The layout of a flat model file
+ *
+ *   header, keys, offsets, radix, values
+ *
+ * The keys are sorted and unique, and the values of key i are values[offsets[i],
+ * offsets[i+1]). If all keys have the same number of values, fixed_len is that
+ * number and the offsets are absent. Only the model itself, such as w and V, is
+ * stored, not the optimizer state.
+ *
+ * The radix table is a stored index over the keys: the keys whose \ref
+ * flat::Header::Slot is s are keys[radix[s], radix[s+1]), so a lookup is a
+ * binary search over a few keys, and opening a file reads nothing but the
+ * header. Each section starts at a multiple of 8 bytes, so all of them are used
+ * in place in the mapping.
+ */
+namespace flat {
+
+static const uint32_t kMagic = 0x4d544c46;  // "FLTM"
+static const uint32_t kVersion = 1;
+
+struct Header {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t num_keys;
+  uint64_t num_vals;
+  uint32_t fixed_len;   // 0 if the offsets are present
+  uint32_t radix_bits;
+  uint64_t min_key;
+  uint64_t max_key;
+  uint32_t shift;
+  uint32_t reserved;
+  // the positions of the sections in the file
+  uint64_t keys_pos;
+  uint64_t offsets_pos;
+  uint64_t radix_pos;
+  uint64_t vals_pos;
+  uint64_t file_size;
+
+  /// \brief the radix slot of a key in [min_key, max_key]
+  inline size_t Slot(uint64_t key) const { return (key - min_key) >> shift; }
+};
+
+inline size_t Align(size_t n) { return (n + 7) / 8 * 8; }
+
+}  // namespace flat
+
+/**
+ * \brief Writes a flat model file. Entries are added in any order, and \ref
+ * Close sorts them and writes the file.
+ */
+class FlatModelWriter {
+ public:
+  /// \param fo the output stream, which is not owned
+  explicit FlatModelWriter(Stream* fo) : fo_(CHECK_NOTNULL(fo)) {
+    offsets_.push_back(0);
+  }
+  ~FlatModelWriter() { CHECK(closed_ || keys_.empty()) << "call Close()"; }
+
+  /// \brief adds the len values of a key
+  void Add(uint64_t key, const float* val, int len) {
+    CHECK(!closed_);
+    CHECK_GT(len, 0);
+    keys_.push_back(key);
+    vals_.insert(vals_.end(), val, val + len);
+    offsets_.push_back(vals_.size());
+  }
+
+  /// \brief the number of keys added
+  size_t size() const { return closed_ ? num_keys_ : keys_.size(); }
+
+  /// \brief sorts the keys and writes the file
+  void Close() {
+    CHECK(!closed_);
+    closed_ = true;
+    size_t n = num_keys_ = keys_.size();
+    std::vector<uint32_t> order;
+    std::vector<uint64_t> keys;
+    if (std::is_sorted(keys_.begin(), keys_.end())) {
+      keys.swap(keys_);
+    } else {
+      CHECK_LT(n, (size_t)UINT32_MAX);
+      order.resize(n);
+      std::iota(order.begin(), order.end(), 0);
+      std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+          return keys_[a] < keys_[b]; });
+      keys.resize(n);
+      for (size_t i = 0; i < n; ++i) keys[i] = keys_[order[i]];
+      std::vector<uint64_t>().swap(keys_);
+    }
+    for (size_t i = 1; i < n; ++i) {
+      CHECK_NE(keys[i-1], keys[i]) << "duplicated key " << keys[i];
+    }
+    auto len = [this, &order](size_t i) {
+      size_t j = order.empty() ? i : order[i];
+      return offsets_[j+1] - offsets_[j];
+    };
+
+    flat::Header h;
+    memset(&h, 0, sizeof(h));
+    h.magic = flat::kMagic;
+    h.version = flat::kVersion;
+    h.num_keys = n;
+    h.num_vals = vals_.size();
+    h.fixed_len = n ? len(0) : 1;
+    for (size_t i = 1; i < n && h.fixed_len; ++i) {
+      if (len(i) != h.fixed_len) h.fixed_len = 0;
+    }
+    if (n) { h.min_key = keys[0]; h.max_key = keys[n-1]; }
+    // about 4 keys per slot
+    int bits = 0;
+    while (bits < 24 && ((size_t)4 << bits) < n) ++ bits;
+    int range_bits = 0;
+    while (range_bits < 64 && ((h.max_key - h.min_key) >> range_bits)) {
+      ++ range_bits;
+    }
+    h.radix_bits = std::min(std::max(bits, 1), range_bits);
+    h.shift = range_bits - h.radix_bits;
+    size_t num_slots = (size_t)1 << h.radix_bits;
+
+    h.keys_pos = flat::Align(sizeof(h));
+    h.offsets_pos = h.keys_pos + n * sizeof(uint64_t);
+    h.radix_pos = h.offsets_pos +
+        (h.fixed_len ? 0 : (n + 1) * sizeof(uint64_t));
+    h.vals_pos = h.radix_pos + (num_slots + 1) * sizeof(uint64_t);
+    h.file_size = flat::Align(h.vals_pos + h.num_vals * sizeof(float));
+
+    char pad[8] = {0};
+    fo_->Write(&h, sizeof(h));
+    fo_->Write(pad, h.keys_pos - sizeof(h));
+    fo_->Write(keys.data(), n * sizeof(uint64_t));
+    std::vector<uint64_t> buf;
+    if (!h.fixed_len) {
+      buf.resize(n + 1);
+      buf[0] = 0;
+      for (size_t i = 0; i < n; ++i) buf[i+1] = buf[i] + len(i);
+      fo_->Write(buf.data(), buf.size() * sizeof(uint64_t));
+    }
+    buf.resize(num_slots + 1);
+    size_t k = 0;
+    for (size_t s = 0; s < num_slots; ++s) {
+      while (k < n && h.Slot(keys[k]) < s) ++ k;
+      buf[s] = k;
+    }
+    buf[num_slots] = n;
+    fo_->Write(buf.data(), buf.size() * sizeof(uint64_t));
+    std::vector<uint64_t>().swap(buf);
+
+    if (order.empty()) {
+      fo_->Write(vals_.data(), vals_.size() * sizeof(float));
+    } else {
+      // permute the values by blocks
+      std::vector<float> blk;
+      for (size_t i = 0; i < n; ++i) {
+        const float* v = vals_.data() + offsets_[order[i]];
+        blk.insert(blk.end(), v, v + len(i));
+        if (blk.size() >= kBlockSize || i + 1 == n) {
+          fo_->Write(blk.data(), blk.size() * sizeof(float));
+          blk.clear();
+        }
+      }
+    }
+    fo_->Write(pad, h.file_size - h.vals_pos - h.num_vals * sizeof(float));
+  }
+
+ private:
+  static const size_t kBlockSize = 1 << 20;
+  Stream* fo_;
+  bool closed_ = false;
+  size_t num_keys_ = 0;
+  std::vector<uint64_t> keys_;
+  std::vector<size_t> offsets_;
+  std::vector<float> vals_;
+};
+
+/**
+ * \brief Reads a flat model file through mmap. Opening it costs about the
+ * same for any model size, and the pages are read when looked up.
+ */
+class FlatModel {
+ public:
+  explicit FlatModel(const std::string& uri) : file_(uri) {
+    CHECK_GE(file_.size(), sizeof(h_)) << uri << " is not a flat model";
+    memcpy(&h_, file_.data(), sizeof(h_));
+    CHECK(h_.magic == flat::kMagic && h_.version == flat::kVersion &&
+          h_.file_size == file_.size()) << uri << " is not a flat model";
+    keys_ = (const uint64_t*)(file_.data() + h_.keys_pos);
+    offsets_ = h_.fixed_len ? NULL :
+               (const uint64_t*)(file_.data() + h_.offsets_pos);
+    radix_ = (const uint64_t*)(file_.data() + h_.radix_pos);
+    vals_ = (const float*)(file_.data() + h_.vals_pos);
+  }
+
+  /// \brief the number of keys
+  size_t size() const { return h_.num_keys; }
+
+  uint64_t key(size_t i) const { return keys_[i]; }
+
+  /// \brief the values of the i-th smallest key, len is set to their number
+  const float* value(size_t i, int* len) const {
+    if (offsets_) {
+      *len = offsets_[i+1] - offsets_[i];
+      return vals_ + offsets_[i];
+    }
+    *len = h_.fixed_len;
+    return vals_ + i * h_.fixed_len;
+  }
+
+  /// \brief the position of key, or size() if not exists
+  size_t Find(uint64_t key) const {
+    if (!InRange(key)) return size();
+    size_t s = h_.Slot(key);
+    const uint64_t* begin = keys_ + radix_[s];
+    const uint64_t* end = keys_ + radix_[s+1];
+    const uint64_t* it = std::lower_bound(begin, end, key);
+    return it != end && *it == key ? it - keys_ : size();
+  }
+
+  /**
+   * \brief pos[i] = Find(key[i]) for i in [0, n)
+   *
+   * A lookup reads the radix table, the keys and then the values, each likely
+   * a cache miss. Here they are prefetched kDist lookups ahead of each other,
+   * so the misses of different keys overlap instead of adding up.
+   */
+  void Find(const uint64_t* key, size_t n, size_t* pos) const {
+    const size_t kDist = 8;
+    for (size_t i = 0; i < n + 2 * kDist; ++i) {
+      if (i < n && InRange(key[i])) {
+        __builtin_prefetch(radix_ + h_.Slot(key[i]));
+      }
+      if (i >= kDist && i - kDist < n && InRange(key[i - kDist])) {
+        __builtin_prefetch(keys_ + radix_[h_.Slot(key[i - kDist])]);
+      }
+      if (i >= 2 * kDist) {
+        size_t j = i - 2 * kDist;
+        pos[j] = Find(key[j]);
+        if (pos[j] != size()) {
+          __builtin_prefetch(offsets_ ? vals_ + offsets_[pos[j]] :
+                             vals_ + pos[j] * h_.fixed_len);
+        }
+      }
+    }
+  }
+
+  /// \brief the values of key, NULL if not exists
+  const float* Get(uint64_t key, int* len) const {
+    size_t i = Find(key);
+    if (i == size()) { *len = 0; return NULL; }
+    return value(i, len);
+  }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(FlatModel);
+
+  inline bool InRange(uint64_t key) const {
+    return size() && key >= h_.min_key && key <= h_.max_key;
+  }
+
+  MappedFile file_;
+  flat::Header h_;
+  const uint64_t* keys_;
+  const uint64_t* offsets_;
+  const uint64_t* radix_;
+  const float* vals_;
+};
+
+}  // namespace dmlc
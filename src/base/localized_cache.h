@@ -0,0 +1,136 @@
+/**
+ * @file   localized_cache.h
+ * @brief  Caches localized minibatches across data passes
+ */
+#pragma once
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "dmlc/logging.h"
+#include "data/row_block.h"
+#include "base/string_stream.h"
+namespace dmlc {
+
+/**
+ * \brief Keeps the results of \ref Localizer, the localized data and the
+ * unique feature ids, of each minibatch, so later data passes over the same
+ * data skip localizing.
+ *
+ * A minibatch is identified by a string key, such as the file part with the
+ * position of the minibatch in it. Entries are kept in memory until they use
+ * \a mem_budget bytes. The following ones are spilled into a file in \a
+ * spill_dir, or dropped if \a spill_dir is empty.
+ *
+ * It is not thread-safe.
+ *
+ * @tparam I the feature id type
+ */
+template <typename I>
+class LocalizedCache {
+ public:
+  LocalizedCache(size_t mem_budget, const std::string& spill_dir = "")
+      : mem_budget_(mem_budget), spill_dir_(spill_dir) { }
+  ~LocalizedCache() {
+    if (fd_ >= 0) close(fd_);
+  }
+
+  /**
+   * \brief Copies the entry of \a key into \a data and \a feaid. Returns false
+   * if not found.
+   */
+  bool Get(const std::string& key,
+           data::RowBlockContainer<unsigned>* data, std::vector<I>* feaid) {
+    auto it = entries_.find(key);
+    if (it == entries_.end()) return false;
+    const Entry& e = it->second;
+    if (e.bytes == 0) {
+      *data = e.data;
+      *feaid = e.feaid;
+      return true;
+    }
+    std::string buf(e.bytes, 0);
+    CHECK_EQ(pread(fd_, &buf[0], e.bytes, e.offset), (ssize_t)e.bytes)
+        << "failed to read " << spill_file_ << ": " << strerror(errno);
+    StringStream ss(buf);
+    Stream* fi = &ss;
+    CHECK(data->Load(fi));
+    CHECK(fi->Read(feaid));
+    return true;
+  }
+
+  /**
+   * \brief Stores a copy of \a data and \a feaid as the entry of \a key
+   */
+  void Put(const std::string& key,
+           const data::RowBlockContainer<unsigned>& data,
+           const std::vector<I>& feaid) {
+    if (entries_.count(key)) return;
+    size_t bytes = MemBytes(data) + feaid.size() * sizeof(I);
+    if (mem_used_ + bytes <= mem_budget_) {
+      Entry& e = entries_[key];
+      e.data = data;
+      e.feaid = feaid;
+      mem_used_ += bytes;
+      return;
+    }
+    if (spill_dir_.empty() || !OpenSpillFile()) return;
+    StringStream ss;
+    Stream* fo = &ss;
+    data.Save(fo);
+    fo->Write(feaid);
+    std::string buf = ss.str();
+    CHECK_EQ(pwrite(fd_, buf.data(), buf.size(), spill_end_),
+             (ssize_t)buf.size())
+        << "failed to write " << spill_file_ << ": " << strerror(errno);
+    Entry& e = entries_[key];
+    e.offset = spill_end_;
+    e.bytes = buf.size();
+    spill_end_ += buf.size();
+  }
+
+  /// \brief the bytes of the entries in memory
+  size_t mem_used() const { return mem_used_; }
+  /// \brief the bytes of the entries in the spill file
+  size_t spilled() const { return spill_end_; }
+
+ private:
+  struct Entry {
+    data::RowBlockContainer<unsigned> data;
+    std::vector<I> feaid;
+    // the position in the spill file, bytes is 0 if in memory
+    size_t offset = 0, bytes = 0;
+  };
+
+  static size_t MemBytes(const data::RowBlockContainer<unsigned>& d) {
+    return d.offset.size() * sizeof(size_t) +
+        (d.label.size() + d.weight.size() + d.value.size()) * sizeof(real_t) +
+        d.index.size() * sizeof(unsigned);
+  }
+
+  // creates the spill file on the first use. it is unlinked at once, so it is
+  // removed when closed
+  bool OpenSpillFile() {
+    if (fd_ >= 0) return true;
+    spill_file_ = spill_dir_ + "/localized.XXXXXX";
+    fd_ = mkstemp(&spill_file_[0]);
+    if (fd_ < 0) {
+      LOG(WARNING) << "failed to create " << spill_file_ << ": "
+                   << strerror(errno) << ", stop caching";
+      spill_dir_.clear();
+      return false;
+    }
+    unlink(spill_file_.c_str());
+    return true;
+  }
+
+  std::unordered_map<std::string, Entry> entries_;
+  size_t mem_budget_, mem_used_ = 0;
+  std::string spill_dir_, spill_file_;
+  int fd_ = -1;
+  size_t spill_end_ = 0;
+};
+
+}  // namespace dmlc
@@ -4,7 +4,8 @@
 #include "dmlc/data.h"
 #include "dmlc/omp.h"
 #include "data/row_block.h"
-#include "base/parallel_sort.h"
+#include "base/radix_sort.h"
+#include "base/reverse_bytes.h"
 
 
 namespace ps {
@@ -14,28 +15,19 @@ DECLARE_uint64(max_key);
 
 namespace dmlc {
 
-/// \brief reverse the bytes of x to make it more uniformly spanning the space
-inline uint64_t ReverseBytes(uint64_t x) {
-  // return x;
-  x = x << 32 | x >> 32;
-  x = (x & 0x0000FFFF0000FFFFULL) << 16 |
-      (x & 0xFFFF0000FFFF0000ULL) >> 16;
-  x = (x & 0x00FF00FF00FF00FFULL) << 8 |
-      (x & 0xFF00FF00FF00FF00ULL) >> 8;
-  x = (x & 0x0F0F0F0F0F0F0F0FULL) << 4 |
-      (x & 0xF0F0F0F0F0F0F0F0ULL) >> 4;
-  return x;
-}
-
 /**
  * @brief Mapping a RowBlock with general indices into continuous indices
  * starting from 0
+ *
+ * The buffers are kept after \ref Clear, so reuse a localizer for all
+ * minibatches to avoid allocating them each time.
+ *
  * @tparam I the index type
  */
 template<typename I>
 class Localizer {
  public:
-  Localizer(int nthreads = 2) : nt_(nthreads) { }
+  Localizer(int nthreads = 2) : nt_(nthreads), sorter_(nthreads) { }
   ~Localizer() { }
   /**
    * @brief Localize a Rowblock
@@ -93,6 +85,8 @@ class Localizer {
   };
 #pragma pack(pop)
   std::vector<Pair> pair_;
+  RadixSorter<Pair> sorter_;
+  std::vector<unsigned> remapped_idx_;
 };
 
 template<typename I>
@@ -129,8 +123,7 @@ void Localizer<I>:: CountUniqIndex(
     }
   }
 
-  ParallelSort(&pair_, nt_,
-               [](const Pair& a, const Pair& b) {return a.k < b.k; });
+  sorter_.Sort(&pair_, [](const Pair& a) { return a.k; });
 
   // save data
   CHECK_NOTNULL(uniq_idx);
@@ -179,7 +172,8 @@ void Localizer<I>::RemapIndex(
 
   // build the index mapping
   unsigned matched = 0;
-  std::vector<unsigned> remapped_idx(pair_.size(), 0);
+  auto& remapped_idx = remapped_idx_;
+  remapped_idx.assign(pair_.size(), 0);
   auto cur_dict = idx_dict.cbegin();
   auto cur_pair = pair_.cbegin();
   while (cur_dict != idx_dict.cend() && cur_pair != pair_.cend()) {
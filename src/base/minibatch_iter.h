@@ -13,6 +13,7 @@
 #include "base/adfea_parser.h"
 #include "base/criteo_parser.h"
 #include "base/crb_parser.h"
+#include "base/cached_parser.h"
 #include "base/debug.h"
 namespace dmlc {
 namespace data {
@@ -22,6 +23,10 @@ namespace data {
  * @param minibatch_size the minibatch size
  * @param if nonzero, then the minibatch is randomly picked from a buffer with
  * *shuf_buf* examples
+ * @param nthreads the number of threads to parse a chunk of criteo and adfea
+ * data
+ * @param cache_dir if not empty, the first pass writes the parsed part into a
+ * local cache file in this directory, and later passes read that file instead
  */
 template<typename IndexType>
 class MinibatchIter {
@@ -29,35 +34,57 @@ class MinibatchIter {
   MinibatchIter(const char* uri, unsigned part_index, unsigned num_parts,
                 const char* type, unsigned minibatch_size,
                 unsigned shuf_buf = 0,
-                float negative_sampling = 1.0)
+                float negative_sampling = 1.0,
+                int nthreads = 2,
+                const std::string& cache_dir = "")
       : mb_size_(minibatch_size), shuf_buf_(shuf_buf),
         negative_sampling_(negative_sampling), start_(0), end_(0) {
     if (shuf_buf) {
       CHECK_GT(shuf_buf, minibatch_size);
       buf_reader_ =
-          new MinibatchIter(uri, part_index, num_parts, type, shuf_buf, 0);
+          new MinibatchIter(uri, part_index, num_parts, type, shuf_buf, 0,
+                            1.0, nthreads, cache_dir);
       parser_ = NULL;
     } else {
       // create parser
-      if (!strcmp(type, "libsvm")) {
+      bool threaded = true;
+      bool crb_file = !strcmp(type, "crb") && CRBFile::IsCRBFile(uri);
+      std::string cache;
+      if (cache_dir.size() && !crb_file) {
+        cache = CacheFile<IndexType>(
+            cache_dir, uri, type, part_index, num_parts);
+      }
+      if (cache.size() && HasCacheFile(cache)) {
+        parser_ = new CRBFileParser<IndexType>(cache, 0, 1);
+        threaded = false;
+      } else if (!strcmp(type, "libsvm")) {
         parser_ = new LibSVMParser<IndexType>(
             InputSplit::Create(uri, part_index, num_parts, "text"), 1);
       } else if (!strcmp(type, "criteo")) {
         parser_ = new CriteoParser<IndexType>(
-            InputSplit::Create(uri, part_index, num_parts, "text"), true);
+            InputSplit::Create(uri, part_index, num_parts, "text"), true,
+            nthreads);
       } else if (!strcmp(type, "criteo_test")) {
         parser_ = new CriteoParser<IndexType>(
-            InputSplit::Create(uri, part_index, num_parts, "text"), false);
+            InputSplit::Create(uri, part_index, num_parts, "text"), false,
+            nthreads);
       } else if (!strcmp(type, "adfea")) {
         parser_ = new AdfeaParser<IndexType>(
-            InputSplit::Create(uri, part_index, num_parts, "text"));
+            InputSplit::Create(uri, part_index, num_parts, "text"), nthreads);
+      } else if (crb_file) {
+        // mmaped, no need to parse in another thread
+        parser_ = new CRBFileParser<IndexType>(uri, part_index, num_parts);
+        threaded = false;
       } else if (!strcmp(type, "crb")) {
         parser_ = new CRBParser<IndexType>(
             InputSplit::Create(uri, part_index, num_parts, "recordio"));
       } else {
         LOG(FATAL) << "unknown datatype " << type;
       }
-      parser_ = new ThreadedParser<IndexType>(parser_);
+      if (threaded && cache.size()) {
+        parser_ = new CacheWriterParser<IndexType>(parser_, cache);
+      }
+      if (threaded) parser_ = new ThreadedParser<IndexType>(parser_);
       buf_reader_ = NULL;
     }
   }
@@ -128,6 +155,15 @@ class MinibatchIter {
     return out_blk_;
   }
 
+  /**
+   * \brief Swaps the buffers of the current minibatch with \a blk, so it can be
+   * kept without copying. \ref Value is invalid afterwards.
+   */
+  void Swap(RowBlockContainer<IndexType>* blk) {
+    std::swap(mb_, *blk);
+    out_blk_ = RowBlock<IndexType>();
+  }
+
  private:
   void Push(size_t pos, size_t len) {
     if (!len) return;
@@ -0,0 +1,103 @@
+/**
+ * @file   mmap_file.h
+ * @brief  Read-only memory mapping of a whole file
+ */
+#pragma once
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string.h>
+#include <string>
+#include "dmlc/io.h"
+#include "dmlc/logging.h"
+namespace dmlc {
+
+/**
+ * \brief Maps a file into memory for reading.
+ *
+ * A local file, either a path or file://path, is mapped by mmap so only the
+ * pages touched are read. Other URIs such as hdfs:// and s3:// are read into
+ * memory by dmlc::Stream.
+ */
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string& uri) {
+    std::string path = LocalPath(uri);
+    if (path.empty()) {
+      ReadAll(uri);
+      return;
+    }
+    int fd = open(path.c_str(), O_RDONLY);
+    CHECK_GE(fd, 0) << "failed to open " << path << ": " << strerror(errno);
+    struct stat st;
+    CHECK_EQ(fstat(fd, &st), 0) << strerror(errno);
+    size_ = st.st_size;
+    if (size_ > 0) {
+      void* p = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      CHECK(p != MAP_FAILED) << "failed to mmap " << path << ": "
+                             << strerror(errno);
+      data_ = (const char*)p;
+      mapped_ = true;
+    }
+    close(fd);
+  }
+
+  ~MappedFile() {
+    if (mapped_) munmap((void*)data_, size_);
+  }
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+  /// \brief true if mmaped, false if read into memory
+  bool mapped() const { return mapped_; }
+
+  /**
+   * \brief Hints the kernel that [offset, offset + len) will be read
+   * sequentially soon
+   */
+  void WillNeed(size_t offset, size_t len) const {
+    if (!mapped_ || len == 0) return;
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t begin = offset / page * page;
+    // the advices are values, not flags, so they are given one by one
+    madvise((void*)(data_ + begin), offset + len - begin, MADV_SEQUENTIAL);
+    madvise((void*)(data_ + begin), offset + len - begin, MADV_WILLNEED);
+  }
+
+  /**
+   * \brief Returns the path of a local file uri, or an empty string for a
+   * remote one
+   */
+  static std::string LocalPath(const std::string& uri) {
+    const std::string file = "file://";
+    if (uri.compare(0, file.size(), file) == 0) return uri.substr(file.size());
+    if (uri.find("://") != std::string::npos) return "";
+    return uri;
+  }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(MappedFile);
+
+  void ReadAll(const std::string& uri) {
+    Stream* fi = CHECK_NOTNULL(Stream::Create(uri.c_str(), "r"));
+    const size_t kChunk = 1 << 26;
+    size_t n = 0;
+    do {
+      buf_.resize(n + kChunk);
+      n += fi->Read(&buf_[n], kChunk);
+    } while (n == buf_.size());
+    buf_.resize(n);
+    delete fi;
+    data_ = buf_.data();
+    size_ = buf_.size();
+  }
+
+  const char* data_ = NULL;
+  size_t size_ = 0;
+  bool mapped_ = false;
+  // the content of a remote file
+  std::string buf_;
+};
+
+}  // namespace dmlc
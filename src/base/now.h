@@ -0,0 +1,18 @@
+/**
+ * @file   now.h
+ * @brief  The time of a steady clock, for timing
+ */
+#pragma once
+#include <chrono>
+namespace dmlc {
+
+/**
+ * \brief returns the seconds of a steady clock. Unlike \ref GetTime it never
+ * jumps with the system time, so only differences of it are meaningful
+ */
+inline double Now() {
+  using namespace std::chrono;
+  return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+}  // namespace dmlc
@@ -0,0 +1,73 @@
+/**
+ * @file   object_pool.h
+ * @brief  A pool of recyclable objects
+ */
+#pragma once
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "dmlc/logging.h"
+namespace dmlc {
+
+/**
+ * \brief A thread-safe pool of objects which are reused instead of being
+ * freed, so the buffers they own keep their capacity.
+ *
+ * \ref Get returns a free object, or creates one if there is none. Objects
+ * still checked out when the pool is destroyed are leaked, so give them back
+ * before.
+ */
+template <typename T>
+class ObjectPool {
+ public:
+  ObjectPool() { }
+  ~ObjectPool() {
+    for (T* obj : free_) delete obj;
+  }
+
+  /// \brief checks out an object
+  T* Get() {
+    std::lock_guard<std::mutex> lk(mu_);
+    if (free_.empty()) {
+      ++ num_created_;
+      return new T();
+    }
+    T* obj = free_.back();
+    free_.pop_back();
+    return obj;
+  }
+
+  /// \brief gives back an object returned by \ref Get
+  void Put(T* obj) {
+    CHECK_NOTNULL(obj);
+    std::lock_guard<std::mutex> lk(mu_);
+    free_.push_back(obj);
+  }
+
+  /// \brief the number of objects created so far
+  size_t num_created() {
+    std::lock_guard<std::mutex> lk(mu_);
+    return num_created_;
+  }
+
+ private:
+  std::mutex mu_;
+  std::vector<T*> free_;
+  size_t num_created_ = 0;
+};
+
+/**
+ * \brief Empties the vector pointed by \a p for reuse. If the vector is still
+ * shared, such as by a message being sent, then \a p is pointed to a new one
+ * instead.
+ */
+template <typename V>
+void RecycleShared(std::shared_ptr<std::vector<V>>* p) {
+  if (*p && p->use_count() == 1) {
+    (*p)->clear();
+  } else {
+    p->reset(new std::vector<V>());
+  }
+}
+
+}  // namespace dmlc
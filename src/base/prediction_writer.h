@@ -0,0 +1,179 @@
+/**
+ * @file   prediction_writer.h
+ * @brief  Writes the predictions of minibatches, as text or binary float32, in
+ * the order of the minibatches
+ */
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "dmlc/io.h"
+#include "dmlc/logging.h"
+#include "dmlc/omp.h"
+namespace dmlc {
+
+/**
+ * \brief Writes v into buf as printf("%g", v), which is also how an ostream
+ * writes it by default, and returns the length, at most 15.
+ *
+ * If |v| is in [1e-4, 1e6), the 6 significant digits are rounded from the
+ * exact value by integer arithmetic, ties to even as glibc, which is several
+ * times faster than snprintf. Other values go to snprintf.
+ */
+inline int FormatFloat(float v, char* buf) {
+  static const double kPow10[] = {1e-4, 1e-3, 1e-2, 1e-1, 1e0, 1e1, 1e2, 1e3,
+                                  1e4, 1e5, 1e6};
+  static const uint64_t kScale[] = {1, 10, 100, 1000, 10000, 100000, 1000000,
+                                    10000000, 100000000, 1000000000};
+  double a = v < 0 ? -(double)v : v;
+  if (!(a >= kPow10[0] && a < kPow10[10])) return snprintf(buf, 16, "%g", v);
+  // a is in [10^x, 10^(x+1))
+  int x = -4;
+  while (a >= kPow10[x + 5]) ++ x;
+
+  // n = round(a * 10^(5-x)), where a = m * 2^-s
+  uint32_t bits; memcpy(&bits, &v, sizeof(bits));
+  uint64_t m = (bits & 0x7fffff) | 0x800000;
+  int s = 150 - ((bits >> 23) & 0xff);
+  uint64_t scaled = m * kScale[5 - x];
+  uint64_t n = scaled >> s, rem = scaled & ((1ULL << s) - 1), half = 1ULL << (s-1);
+  if (rem > half || (rem == half && (n & 1))) ++ n;
+  if (n == 1000000) {
+    n = 100000; ++ x;
+    if (x == 6) return snprintf(buf, 16, "%g", v);
+  }
+
+  char d[6];
+  for (int i = 5; i >= 0; --i) { d[i] = '0' + n % 10; n /= 10; }
+  int nd = 6;
+  while (nd > 1 && d[nd-1] == '0') -- nd;
+  char* p = buf;
+  if (v < 0) *p++ = '-';
+  if (x >= 0) {
+    for (int i = 0; i <= x; ++i) *p++ = d[i];
+    if (nd > x + 1) {
+      *p++ = '.';
+      for (int i = x + 1; i < nd; ++i) *p++ = d[i];
+    }
+  } else {
+    *p++ = '0'; *p++ = '.';
+    for (int i = -1; i > x; --i) *p++ = '0';
+    for (int i = 0; i < nd; ++i) *p++ = d[i];
+  }
+  *p = '\0';
+  return p - buf;
+}
+
+inline int FormatFloat(double v, char* buf) {
+  return snprintf(buf, 32, "%g", v);
+}
+
+/**
+ * \brief Writes the predictions of the minibatches of a workload into a stream.
+ *
+ * The minibatches can be given in any order and by any threads, each one with
+ * its position in the workload, and are written in the order of the positions,
+ * 0, 1, 2, .... A thread formats its own minibatch, so they are formatted in
+ * parallel, and only the writes are serialized. A minibatch is kept until the
+ * ones before it are written, so the memory is bounded by the number of
+ * minibatches in flight.
+ *
+ * The text format is a prediction per line as an ostream writes it. The binary
+ * format is the predictions as float32 in the byte order of the machine,
+ * without any header, 4 bytes per row.
+ */
+class PredictionWriter {
+ public:
+  /**
+   * @param fo the output stream, which is not owned
+   * @param binary if true, write float32 instead of text
+   */
+  PredictionWriter(Stream* fo, bool binary)
+      : fo_(CHECK_NOTNULL(fo)), binary_(binary) { }
+  ~PredictionWriter() {
+    CHECK(ready_.empty()) << "minibatch " << next_ << " is never written";
+  }
+
+  /**
+   * \brief writes the predictions p[0, n) of the minibatch at position id
+   *
+   * @param nt the number of threads to format the text
+   */
+  template <typename V>
+  void Write(size_t id, const V* p, size_t n, int nt = 1) {
+    std::string buf;
+    if (binary_) {
+      buf.resize(n * sizeof(float));
+      float* out = (float*)&buf[0];
+      for (size_t i = 0; i < n; ++i) out[i] = p[i];
+    } else if (nt <= 1 || n < 10000) {
+      Format(p, n, &buf);
+    } else {
+      std::vector<std::string> part(nt);
+#pragma omp parallel for num_threads(nt)
+      for (int k = 0; k < nt; ++k) {
+        size_t begin = n * k / nt, end = n * (k + 1) / nt;
+        Format(p + begin, end - begin, &part[k]);
+      }
+      size_t len = 0;
+      for (const auto& s : part) len += s.size();
+      buf.reserve(len);
+      for (const auto& s : part) buf += s;
+    }
+    Put(id, &buf);
+  }
+
+  /// \brief the number of minibatches written
+  size_t num_written() {
+    std::lock_guard<std::mutex> lk(mu_);
+    return next_;
+  }
+
+ private:
+  template <typename V>
+  static void Format(const V* p, size_t n, std::string* buf) {
+    buf->resize(n * 16);
+    char* out = &(*buf)[0];
+    size_t len = 0;
+    for (size_t i = 0; i < n; ++i) {
+      len += FormatFloat(p[i], out + len);
+      out[len++] = '\n';
+    }
+    buf->resize(len);
+  }
+
+  // queues minibatch id, and writes the queued ones in order if no other thread
+  // is writing
+  void Put(size_t id, std::string* buf) {
+    std::unique_lock<std::mutex> lk(mu_);
+    CHECK_GE(id, next_) << "minibatch " << id << " is written twice";
+    CHECK(ready_.emplace(id, std::move(*buf)).second)
+        << "minibatch " << id << " is written twice";
+    if (writing_) return;
+    writing_ = true;
+    while (!ready_.empty() && ready_.begin()->first == next_) {
+      std::string data = std::move(ready_.begin()->second);
+      ready_.erase(ready_.begin());
+      ++ next_;
+      lk.unlock();
+      fo_->Write(data.data(), data.size());
+      lk.lock();
+    }
+    writing_ = false;
+  }
+
+  Stream* fo_;
+  bool binary_;
+  std::mutex mu_;
+  // the minibatches waiting for the ones before them
+  std::map<size_t, std::string> ready_;
+  // the position of the next minibatch to write
+  size_t next_ = 0;
+  bool writing_ = false;
+};
+
+}  // namespace dmlc
@@ -0,0 +1,131 @@
+/**
+ * @file   radix_sort.h
+ * @brief  Parallel LSD radix sort by an unsigned integer key
+ */
+#pragma once
+#include <stdint.h>
+#include <type_traits>
+#include <vector>
+#include "dmlc/logging.h"
+#include "dmlc/omp.h"
+namespace dmlc {
+
+/**
+ * \brief Sorts an array of T by an unsigned integer key, using \a kBits bits
+ * per pass. The sort is stable.
+ *
+ * The scratch buffers are kept between calls, so a sorter reused for every
+ * minibatch does not allocate once the buffers are large enough. The passes on
+ * the digits which all keys share, such as the high bits of small keys, are
+ * skipped.
+ *
+ * @tparam T the element type, which should be cheap to copy
+ */
+template <typename T>
+class RadixSorter {
+ public:
+  static const int kBits = 11;
+  static const size_t kRadix = (size_t)1 << kBits;
+  /// \brief arrays shorter than it are sorted by a single thread
+  static const size_t kMinParallel = 1 << 16;
+
+  explicit RadixSorter(int nthreads = 2) : nt_(nthreads) {
+    CHECK_GT(nt_, 0);
+  }
+  ~RadixSorter() { }
+
+  /**
+   * @param data the array to sort
+   * @param get_key the function returns the key of an element, such as [](const
+   * T& a) { return a.k; }
+   */
+  template <typename GetKey>
+  void Sort(std::vector<T>* data, const GetKey& get_key) {
+    typedef typename std::decay<decltype(get_key(T()))>::type K;
+    static_assert(std::is_unsigned<K>::value, "the key must be unsigned");
+    const int num_passes = (sizeof(K) * 8 + kBits - 1) / kBits;
+
+    size_t n = data->size();
+    if (n <= 1) return;
+    int nt = n < kMinParallel ? 1 : nt_;
+    buf_.resize(n);
+
+    // the array is split into nt segments. they are looped over, so all are
+    // handled even if openmp starts fewer than nt threads
+
+    // the histograms of all digits, to find the passes to skip
+    hist_.assign((size_t)nt * num_passes * kRadix, 0);
+#pragma omp parallel for num_threads(nt) schedule(static, 1)
+    for (int t = 0; t < nt; ++t) {
+      size_t* h = hist_.data() + t * num_passes * kRadix;
+      for (size_t i = Begin(n, nt, t); i < Begin(n, nt, t+1); ++i) {
+        K key = get_key((*data)[i]);
+        for (int p = 0; p < num_passes; ++p) {
+          ++ h[p * kRadix + Digit(key, p)];
+        }
+      }
+    }
+    std::vector<bool> skip(num_passes);
+    for (int p = 0; p < num_passes; ++p) {
+      for (size_t b = 0; b < kRadix; ++b) {
+        size_t cnt = 0;
+        for (int t = 0; t < nt; ++t) {
+          cnt += hist_[(t * num_passes + p) * kRadix + b];
+        }
+        if (cnt == n) { skip[p] = true; break; }
+        if (cnt) break;
+      }
+    }
+
+    T* src = data->data();
+    T* dst = buf_.data();
+    pos_.resize((size_t)nt * kRadix);
+    for (int p = 0; p < num_passes; ++p) {
+      if (skip[p]) continue;
+      // count the digits of each segment
+#pragma omp parallel for num_threads(nt) schedule(static, 1)
+      for (int t = 0; t < nt; ++t) {
+        size_t* h = pos_.data() + t * kRadix;
+        std::fill(h, h + kRadix, 0);
+        for (size_t i = Begin(n, nt, t); i < Begin(n, nt, t+1); ++i) {
+          ++ h[Digit(get_key(src[i]), p)];
+        }
+      }
+      // segment t writes bucket b from pos_[t][b]
+      size_t sum = 0;
+      for (size_t b = 0; b < kRadix; ++b) {
+        for (int t = 0; t < nt; ++t) {
+          size_t cnt = pos_[t * kRadix + b];
+          pos_[t * kRadix + b] = sum;
+          sum += cnt;
+        }
+      }
+      // scatter
+#pragma omp parallel for num_threads(nt) schedule(static, 1)
+      for (int t = 0; t < nt; ++t) {
+        size_t* pos = pos_.data() + t * kRadix;
+        for (size_t i = Begin(n, nt, t); i < Begin(n, nt, t+1); ++i) {
+          dst[pos[Digit(get_key(src[i]), p)]++] = src[i];
+        }
+      }
+      std::swap(src, dst);
+    }
+    if (src != data->data()) data->swap(buf_);
+  }
+
+ private:
+  static inline size_t Begin(size_t n, int nt, int t) {
+    return n * t / nt;
+  }
+
+  template <typename K>
+  static inline size_t Digit(K key, int pass) {
+    return (size_t)(key >> (pass * kBits)) & (kRadix - 1);
+  }
+
+  int nt_;
+  std::vector<T> buf_;
+  std::vector<size_t> hist_, pos_;
+};
+
+}  // namespace dmlc
@@ -0,0 +1,22 @@
+/**
+ * @file   reverse_bytes.h
+ * @brief  The mapping from feature ids to the keys of the servers
+ */
+#pragma once
+#include <stdint.h>
+namespace dmlc {
+
+/// \brief reverse the bytes of x to make it more uniformly spanning the space
+inline uint64_t ReverseBytes(uint64_t x) {
+  // return x;
+  x = x << 32 | x >> 32;
+  x = (x & 0x0000FFFF0000FFFFULL) << 16 |
+      (x & 0xFFFF0000FFFF0000ULL) >> 16;
+  x = (x & 0x00FF00FF00FF00FFULL) << 8 |
+      (x & 0xFF00FF00FF00FF00ULL) >> 8;
+  x = (x & 0x0F0F0F0F0F0F0F0FULL) << 4 |
+      (x & 0xF0F0F0F0F0F0F0F0ULL) >> 4;
+  return x;
+}
+
+}  // namespace dmlc
@@ -0,0 +1,129 @@
+/**
+ * @file   scorer.h
+ * @brief  Scores rows by a read-only difacto or linear model, for serving
+ */
+#pragma once
+#include <stdint.h>
+#include <limits>
+#include <vector>
+#include "data/row_block.h"
+#include "base/flat_model.h"
+#include "base/reverse_bytes.h"
+#include "base/fast_math.h"
+namespace dmlc {
+
+/**
+ * \brief Scores rows by a \ref FlatModel, where a key has w, or w and V for
+ * difacto. As difacto::Loss::Evaluate,
+ *
+ *   py_i = X_i w + .5 * (|X_i V|^2 - sum_j X_ij^2 |V_j|^2)
+ *
+ * and the second term is 0 for a linear model.
+ *
+ * It needs neither ps-lite nor a localized minibatch: the feature ids of a row
+ * are mapped to the keys of the servers and looked up in the model directly. A
+ * scorer only reads the model, so the threads of a service can share it, and a
+ * call allocates nothing once a thread has seen the embedding dimension.
+ *
+ * A key not in the model is skipped, the same as a feature never seen in
+ * training or a zero entry the dump left out. So the model must have the parts
+ * of all servers, or the keys of the missing parts are silently scored as 0;
+ * \ref Score can count the skipped keys to check it.
+ */
+class Scorer {
+ public:
+  /**
+   * @param model the model, not owned
+   * @param max_key the max_key of training, the feature ids are hashed into
+   * it if it is less than 2^64-1
+   * @param l1_shrk as the difacto servers, V_j is not used if w_j is 0
+   */
+  explicit Scorer(const FlatModel& model,
+                  uint64_t max_key = std::numeric_limits<uint64_t>::max(),
+                  bool l1_shrk = true)
+      : model_(model), max_key_(max_key), l1_shrk_(l1_shrk) { }
+
+  /// \brief the key of a feature id, the same as \ref Localizer
+  inline uint64_t Key(uint64_t id) const {
+    return max_key_ < std::numeric_limits<uint64_t>::max() ?
+        id % max_key_ : ReverseBytes(id);
+  }
+
+  /**
+   * \brief py[i] = the prediction of row i of blk for i in [begin, end)
+   *
+   * The keys of all these rows are looked up together first, so the cache
+   * misses of the lookups overlap.
+   *
+   * @param prob if true, the probability sigmoid(py[i]) instead
+   * @param num_missed if not NULL, added by the number of the features of
+   * these rows whose keys are not in the model
+   */
+  template <typename I>
+  void Score(const RowBlock<I>& blk, size_t begin, size_t end, float* py,
+             bool prob = false, size_t* num_missed = NULL) const {
+    // the keys and their positions in the model, kept by the thread
+    static thread_local std::vector<uint64_t> key;
+    static thread_local std::vector<size_t> pos;
+    size_t base = blk.offset[begin], nnz = blk.offset[end] - base;
+    if (key.size() < nnz) { key.resize(nnz); pos.resize(nnz); }
+    for (size_t j = 0; j < nnz; ++j) key[j] = Key(blk.index[base + j]);
+    model_.Find(key.data(), nnz, pos.data());
+    if (num_missed) {
+      for (size_t j = 0; j < nnz; ++j) *num_missed += pos[j] == model_.size();
+    }
+    for (size_t i = begin; i < end; ++i) {
+      py[i] = Score(blk, i, pos.data() + blk.offset[i] - base);
+    }
+    if (prob) fastmath::Sigmoid(py + begin, py + begin, end - begin);
+  }
+
+  /// \brief py[i] = the prediction of row i of blk for all rows
+  template <typename I>
+  void Score(const RowBlock<I>& blk, float* py, bool prob = false) const {
+    Score(blk, 0, blk.size, py, prob);
+  }
+
+ private:
+  // row i of blk, where the key of its j-th feature is at pos[j] of the model
+  template <typename I>
+  float Score(const RowBlock<I>& blk, size_t i, const size_t* pos) const {
+    // X_i V, kept by the thread
+    static thread_local std::vector<float> xv;
+    int dim = 0;
+    float py = 0, sq = 0;
+    size_t n = blk.offset[i+1] - blk.offset[i];
+    const real_t* value = blk.value ? blk.value + blk.offset[i] : NULL;
+    for (size_t j = 0; j < n; ++j) {
+      if (pos[j] == model_.size()) continue;
+      int len;
+      const float* w = model_.value(pos[j], &len);
+      float x = value ? value[j] : 1;
+      py += x * w[0];
+      if (len == 1 || (l1_shrk_ && w[0] == 0)) continue;
+      const float* V = w + 1;
+      int d = len - 1;
+      if (d > dim) {
+        if (xv.size() < (size_t)d) xv.resize(d);
+        std::fill(xv.begin() + dim, xv.begin() + d, 0);
+        dim = d;
+      }
+      float* XV = xv.data();
+      float vv = 0;
+      for (int k = 0; k < d; ++k) {
+        XV[k] += x * V[k];
+        vv += V[k] * V[k];
+      }
+      sq += x * x * vv;
+    }
+    float xvxv = 0;
+    for (int k = 0; k < dim; ++k) xvxv += xv[k] * xv[k];
+    return py + .5 * (xvxv - sq);
+  }
+
+  const FlatModel& model_;
+  uint64_t max_key_;
+  bool l1_shrk_;
+};
+
+}  // namespace dmlc
@@ -0,0 +1,101 @@
+/**
+ * @file   slab_arena.h
+ * @brief  A slab allocator for fixed-length arrays
+ */
+#pragma once
+#include <stdint.h>
+#include <cstring>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <dmlc/logging.h>
+namespace dmlc {
+
+/**
+ * \brief An arena storing many fixed-length arrays (slots) of type T
+ * contiguously.
+ *
+ * Slots are referred by 32-bit ids rather than pointers. Memory is allocated in
+ * chunks of \ref kChunkSize slots, and chunks are never moved or freed
+ * before the arena is destroyed, so the pointer returned by \ref Get is valid
+ * until the slot is freed. Allocating and freeing are thread-safe, while
+ * accessing a slot is lock-free.
+ *
+ * @tparam T the element type, which should be a POD type
+ */
+template <typename T>
+class SlabArena {
+ public:
+  /// \brief #bits of the in-chunk slot position
+  static const int kChunkBits = 16;
+  static const uint32_t kChunkSize = 1U << kChunkBits;
+  static const uint32_t kMaxChunks = 1U << (32 - kChunkBits);
+
+  /**
+   * @param stride the length of each slot
+   */
+  explicit SlabArena(int stride)
+      : stride_(stride), chunks_(new T*[kMaxChunks]) {
+    CHECK_GT(stride_, 0);
+    memset(chunks_.get(), 0, kMaxChunks * sizeof(T*));
+  }
+
+  ~SlabArena() {
+    for (uint32_t i = 0; i < num_chunks_; ++i) delete [] chunks_[i];
+  }
+
+  /**
+   * \brief Returns the id of a new slot. Its content is undefined
+   */
+  uint32_t Alloc() {
+    std::lock_guard<std::mutex> lk(mu_);
+    if (!free_.empty()) {
+      uint32_t id = free_.back(); free_.pop_back();
+      return id;
+    }
+    if ((size_ & (kChunkSize - 1)) == 0) {
+      CHECK_LT(num_chunks_, kMaxChunks) << "out of 32-bit slot ids";
+      chunks_[num_chunks_++] = new T[(size_t)kChunkSize * stride_];
+    }
+    return size_++;
+  }
+
+  /**
+   * \brief Gives back a slot allocated by \ref Alloc
+   */
+  void Free(uint32_t id) {
+    std::lock_guard<std::mutex> lk(mu_);
+    free_.push_back(id);
+  }
+
+  /**
+   * \brief Returns the pointer to the first element of a slot
+   */
+  inline T* Get(uint32_t id) const {
+    return chunks_[id >> kChunkBits] + (size_t)(id & (kChunkSize-1)) * stride_;
+  }
+
+  /// \brief the length of each slot
+  int stride() const { return stride_; }
+
+  /// \brief the number of slots being used
+  size_t size() const {
+    std::lock_guard<std::mutex> lk(mu_);
+    return size_ - free_.size();
+  }
+
+  /// \brief the number of bytes allocated
+  size_t MemCostBytes() const {
+    return (size_t)num_chunks_ * kChunkSize * stride_ * sizeof(T);
+  }
+
+ private:
+  int stride_;
+  std::unique_ptr<T*[]> chunks_;
+  uint32_t num_chunks_ = 0;
+  uint32_t size_ = 0;
+  std::vector<uint32_t> free_;
+  mutable std::mutex mu_;
+};
+
+}  // namespace dmlc
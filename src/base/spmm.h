@@ -6,7 +6,7 @@
 #include <cstring>
 #include "dmlc/data.h"
 #include "dmlc/omp.h"
-#include "base/spmv.h"  // for Range
+#include "base/spmv.h"  // for Range, RowSegments and TransposedSpMat
 
 namespace dmlc {
 
@@ -18,22 +18,33 @@ class SpMM {
   static const int kDefaultNT = 2;
   using SpMat = RowBlock<unsigned>;
 
-  /** \brief y = D * x */
+  /**
+   * \brief y = D * x
+   *
+   * @param seg the row segments of D, if NULL then computed for nt
+   */
   template<typename V>
   static void Times(const SpMat& D, const std::vector<V>& x,
-                    std::vector<V>* y, int nt = kDefaultNT) {
+                    std::vector<V>* y, int nt = kDefaultNT,
+                    const RowSegments* seg = NULL) {
     if (x.empty()) return;
     CHECK_NOTNULL(y);
     int dim = (int)(y->size() / D.size);
-    Times<V>(D, x.data(), y->data(), dim, nt);
+    Times<V>(D, x.data(), y->data(), dim, nt, seg);
   }
 
 
-  /** \brief y = D^T * x */
+  /**
+   * \brief y = D^T * x
+   *
+   * @param DT the transpose of D, if NULL then each thread scans all rows of D
+   * for the columns in its range
+   */
   template<typename V>
   static void TransTimes(const SpMat& D, const std::vector<V>& x,
-                         std::vector<V>* y, int nt = kDefaultNT) {
-    TransTimes<V>(D, x, 0, std::vector<V>(), y, nt);
+                         std::vector<V>* y, int nt = kDefaultNT,
+                         const TransposedSpMat* DT = NULL) {
+    TransTimes<V>(D, x, 0, std::vector<V>(), y, nt, DT);
   }
 
   /** \brief y = D^T * x + p * z */
@@ -41,25 +52,27 @@ class SpMM {
   template<typename V>
   static void TransTimes(const SpMat& D, const std::vector<V>& x,
                          V p, const std::vector<V>& z,
-                         std::vector<V>* y, int nt = kDefaultNT) {
+                         std::vector<V>* y, int nt = kDefaultNT,
+                         const TransposedSpMat* DT = NULL) {
     if (x.empty()) return;
     int dim = (int)(x.size() / D.size);
     if (z.size() == y->size() && p != 0) {
-      TransTimes<V>(D, x.data(), z.data(), p, y->data(), y->size(), dim, nt);
+      TransTimes<V>(D, x.data(), z.data(), p, y->data(), y->size(), dim, nt, DT);
     } else {
-      TransTimes<V>(D, x.data(), NULL, 0, y->data(), y->size(), dim, nt);
+      TransTimes<V>(D, x.data(), NULL, 0, y->data(), y->size(), dim, nt, DT);
     }
   }
  private:
   // y = D * x
   template<typename V>
   static void Times(const SpMat& D, const V* const x,
-                    V* y, int dim, int nt = kDefaultNT) {
+                    V* y, int dim, int nt, const RowSegments* seg) {
+    RowSegments tmp;
+    if (seg == NULL) { tmp.Init(D, nt); seg = &tmp; }
     memset(y, 0, D.size * dim * sizeof(V));
-#pragma omp parallel num_threads(nt)
-    {
-      Range rg = Range(0, D.size).Segment(
-          omp_get_thread_num(), omp_get_num_threads());
+#pragma omp parallel for num_threads(nt) schedule(static, 1)
+    for (size_t s = 0; s < seg->size(); ++s) {
+      Range rg = (*seg)[s];
 
       for (size_t i = rg.begin; i < rg.end; ++i) {
         if (D.offset[i] == D.offset[i+1]) continue;
@@ -85,7 +98,17 @@ class SpMM {
   static void TransTimes(const SpMat& D, const V* const x,
                          const V* const z, V p,
                          V* y, size_t y_size, int dim,
-                         int nt = kDefaultNT) {
+                         int nt, const TransposedSpMat* DT) {
+    if (DT) {
+      // D' * x is a product with the rows of D', which overwrites y
+      CHECK_EQ(DT->mat().size * dim, y_size);
+      Times<V>(DT->mat(), x, y, dim, nt, &DT->segments());
+      if (z) {
+        for (size_t i = 0; i < y_size; ++i) y[i] += z[i] * p;
+      }
+      return;
+    }
+
     if (z) {
       for (size_t i = 0; i < y_size; ++i) y[i] = z[i] * p;
     } else {
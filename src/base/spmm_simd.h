@@ -0,0 +1,282 @@
+/**
+ * @file   spmm_simd.h
+ * @brief  SIMD kernels of the FM passes of difacto for the common embedding
+ * dimensions
+ */
+#pragma once
+#include <stdint.h>
+#include <cstddef>
+#include <cstring>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DMLC_SPMM_X86 1
+#endif
+namespace dmlc {
+namespace spmm {
+
+/// \brief the instruction sets the kernels are compiled for
+enum SimdLevel { kGeneric = 0, kAVX2 = 1, kAVX512 = 2 };
+
+/// \brief returns the best level the CPU supports
+inline SimdLevel DetectSimdLevel() {
+#ifdef DMLC_SPMM_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return kAVX512;
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return kAVX2;
+  }
+#endif
+  return kGeneric;
+}
+
+/**
+ * \brief the level used by \ref GetKernels. It is detected at the first call,
+ * and can be lowered to compare the kernels.
+ */
+inline SimdLevel& ActiveSimdLevel() {
+  static SimdLevel level = DetectSimdLevel();
+  return level;
+}
+
+/// \brief a column without embedding in the col_map of the kernels
+static const unsigned kNoEmbedding = (unsigned)-1;
+
+/**
+ * \brief the forward pass of FM for rows i in [begin, end) of X in a single
+ * sweep:
+ *
+ *   py_w[i] = X_i w, XV_i = X_i V,
+ *   py[i] = py_w[i] + .5 * (|XV_i|^2 - sum_j X_ij^2 |V_j|^2)
+ *
+ * X is given in CSR, value is NULL for a binary X. V_j is the row col_map[j]
+ * of V, and column j has no embedding if it is kNoEmbedding. XV_i is the row i
+ * of XV, with length dim.
+ */
+typedef void (*EvaluateKernel)(
+    const size_t* offset, const unsigned* index, const float* value,
+    size_t begin, size_t end, const float* w, const unsigned* col_map,
+    const float* V, float* XV, float* py_w, float* py);
+
+/**
+ * \brief the gradient of V of FM for columns j in [begin, end) of X, given p
+ * and XV = X V from \ref EvaluateKernel:
+ *
+ *   grad_e += sum_i p_i X_ij XV_i - (sum_i p_i X_ij^2) V_e, e = col_map[j]
+ *
+ * offset, index and value are the transpose of X in CSR, so a column is
+ * visited by one thread only.
+ */
+typedef void (*GradKernel)(
+    const size_t* offset, const unsigned* index, const float* value,
+    size_t begin, size_t end, const unsigned* col_map, const float* p,
+    const float* XV, const float* V, float* grad);
+
+/// \brief the kernels for a particular dim
+struct Kernels {
+  EvaluateKernel evaluate;
+  GradKernel grad;
+};
+
+/**
+ * The vector operations used by the kernels. Vec is a register of kWidth
+ * floats. Every function of a SIMD op carries the same target attribute as the
+ * kernels using it, otherwise it cannot be inlined.
+ */
+struct GenericOp {
+  // the vector extension of gcc and clang, which is mapped into SSE or NEON
+  typedef float Vec __attribute__((vector_size(16)));
+  static const int kWidth = 4;
+  static inline Vec Zero() { Vec a = {0, 0, 0, 0}; return a; }
+  static inline Vec Set1(float a) { Vec b = {a, a, a, a}; return b; }
+  static inline Vec Load(const float* p) { Vec a; memcpy(&a, p, 16); return a; }
+  static inline void Store(float* p, Vec a) { memcpy(p, &a, 16); }
+  static inline Vec Add(Vec a, Vec b) { return a + b; }
+  static inline Vec Mul(Vec a, Vec b) { return a * b; }
+  static inline Vec Fma(Vec a, Vec b, Vec c) { return a * b + c; }
+  static inline float Sum(Vec a) { return (a[0] + a[1]) + (a[2] + a[3]); }
+};
+
+#ifdef DMLC_SPMM_X86
+#define DMLC_SPMM_AVX2 __attribute__((target("avx2,fma")))
+#define DMLC_SPMM_AVX512 __attribute__((target("avx512f")))
+#define DMLC_SPMM_OP(TARGET) static inline TARGET __attribute__((always_inline))
+
+struct AVX2x4Op {
+  typedef __m128 Vec;
+  static const int kWidth = 4;
+  DMLC_SPMM_OP(DMLC_SPMM_AVX2) Vec Zero() { return _mm_setzero_ps(); }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX2) Vec Set1(float a) { return _mm_set1_ps(a); }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX2) Vec Load(const float* p) { return _mm_loadu_ps(p); }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX2) void Store(float* p, Vec a) { _mm_storeu_ps(p, a); }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX2) Vec Add(Vec a, Vec b) { return _mm_add_ps(a, b); }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX2) Vec Mul(Vec a, Vec b) { return _mm_mul_ps(a, b); }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX2) Vec Fma(Vec a, Vec b, Vec c) {
+    return _mm_fmadd_ps(a, b, c);
+  }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX2) float Sum(Vec a) {
+    a = _mm_add_ps(a, _mm_movehl_ps(a, a));
+    return _mm_cvtss_f32(_mm_add_ss(a, _mm_shuffle_ps(a, a, 1)));
+  }
+};
+
+struct AVX2x8Op {
+  typedef __m256 Vec;
+  static const int kWidth = 8;
+  DMLC_SPMM_OP(DMLC_SPMM_AVX2) Vec Zero() { return _mm256_setzero_ps(); }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX2) Vec Set1(float a) { return _mm256_set1_ps(a); }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX2) Vec Load(const float* p) { return _mm256_loadu_ps(p); }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX2) void Store(float* p, Vec a) { _mm256_storeu_ps(p, a); }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX2) Vec Add(Vec a, Vec b) { return _mm256_add_ps(a, b); }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX2) Vec Mul(Vec a, Vec b) { return _mm256_mul_ps(a, b); }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX2) Vec Fma(Vec a, Vec b, Vec c) {
+    return _mm256_fmadd_ps(a, b, c);
+  }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX2) float Sum(Vec a) {
+    return AVX2x4Op::Sum(_mm_add_ps(_mm256_castps256_ps128(a),
+                                    _mm256_extractf128_ps(a, 1)));
+  }
+};
+
+struct AVX512x16Op {
+  typedef __m512 Vec;
+  static const int kWidth = 16;
+  DMLC_SPMM_OP(DMLC_SPMM_AVX512) Vec Zero() { return _mm512_setzero_ps(); }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX512) Vec Set1(float a) { return _mm512_set1_ps(a); }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX512) Vec Load(const float* p) { return _mm512_loadu_ps(p); }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX512) void Store(float* p, Vec a) { _mm512_storeu_ps(p, a); }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX512) Vec Add(Vec a, Vec b) { return _mm512_add_ps(a, b); }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX512) Vec Mul(Vec a, Vec b) { return _mm512_mul_ps(a, b); }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX512) Vec Fma(Vec a, Vec b, Vec c) {
+    return _mm512_fmadd_ps(a, b, c);
+  }
+  DMLC_SPMM_OP(DMLC_SPMM_AVX512) float Sum(Vec a) {
+    return _mm512_reduce_add_ps(a);
+  }
+};
+#endif  // DMLC_SPMM_X86
+
+/**
+ * \brief defines Evaluate##NAME<DIM, Op> and Grad##NAME<DIM, Op> compiled
+ * with the function attribute TARGET. A row of XV or of the gradient has DIM /
+ * Op::kWidth registers, which are kept in registers while a row of X or a
+ * column of X is being processed.
+ */
+#define DMLC_SPMM_DEFINE_KERNELS(NAME, TARGET)                          \
+  template <int DIM, typename Op> TARGET                                \
+  void Evaluate##NAME(const size_t* offset, const unsigned* index,      \
+                      const float* value, size_t begin, size_t end,     \
+                      const float* w, const unsigned* col_map,          \
+                      const float* V, float* XV, float* py_w,           \
+                      float* py) {                                      \
+    static_assert(DIM % Op::kWidth == 0, "bad dim");                    \
+    const int R = DIM / Op::kWidth;                                     \
+    typename Op::Vec xv[R];                                             \
+    for (size_t i = begin; i < end; ++i) {                              \
+      for (int r = 0; r < R; ++r) xv[r] = Op::Zero();                   \
+      /* sum_j X_ij^2 V_j.^2, summed up at the end of the row */        \
+      typename Op::Vec xxvv = Op::Zero();                               \
+      float lin = 0;                                                    \
+      for (size_t j = offset[i]; j < offset[i+1]; ++j) {                \
+        float x = value ? value[j] : 1;                                 \
+        unsigned c = index[j];                                          \
+        lin += x * w[c];                                                \
+        unsigned e = col_map[c];                                        \
+        if (e == kNoEmbedding) continue;                                \
+        const float* v = V + (size_t)e * DIM;                           \
+        typename Op::Vec vx = Op::Set1(x), vxx = Op::Set1(x * x);       \
+        for (int r = 0; r < R; ++r) {                                   \
+          typename Op::Vec v_r = Op::Load(v + r * Op::kWidth);          \
+          xv[r] = Op::Fma(v_r, vx, xv[r]);                              \
+          xxvv = Op::Fma(Op::Mul(v_r, v_r), vxx, xxvv);                 \
+        }                                                               \
+      }                                                                 \
+      typename Op::Vec s = Op::Zero();                                  \
+      float* xv_i = XV + i * DIM;                                       \
+      for (int r = 0; r < R; ++r) {                                     \
+        s = Op::Fma(xv[r], xv[r], s);                                   \
+        Op::Store(xv_i + r * Op::kWidth, xv[r]);                        \
+      }                                                                 \
+      py_w[i] = lin;                                                    \
+      py[i] = lin + .5f * (Op::Sum(s) - Op::Sum(xxvv));                 \
+    }                                                                   \
+  }                                                                     \
+                                                                        \
+  template <int DIM, typename Op> TARGET                                \
+  void Grad##NAME(const size_t* offset, const unsigned* index,          \
+                  const float* value, size_t begin, size_t end,         \
+                  const unsigned* col_map, const float* p,              \
+                  const float* XV, const float* V, float* grad) {       \
+    static_assert(DIM % Op::kWidth == 0, "bad dim");                    \
+    const int R = DIM / Op::kWidth;                                     \
+    typename Op::Vec g[R];                                              \
+    for (size_t c = begin; c < end; ++c) {                              \
+      unsigned e = col_map[c];                                          \
+      if (e == kNoEmbedding) continue;                                  \
+      float* g_e = grad + (size_t)e * DIM;                              \
+      for (int r = 0; r < R; ++r) g[r] = Op::Load(g_e + r * Op::kWidth); \
+      float b = 0;                                                      \
+      for (size_t j = offset[c]; j < offset[c+1]; ++j) {                \
+        unsigned i = index[j];                                          \
+        if (p[i] == 0) continue;                                        \
+        float x = value ? value[j] : 1;                                 \
+        float a = p[i] * x;                                             \
+        b += a * x;                                                     \
+        const float* xv_i = XV + (size_t)i * DIM;                       \
+        typename Op::Vec va = Op::Set1(a);                              \
+        for (int r = 0; r < R; ++r) {                                   \
+          g[r] = Op::Fma(Op::Load(xv_i + r * Op::kWidth), va, g[r]);    \
+        }                                                               \
+      }                                                                 \
+      const float* v = V + (size_t)e * DIM;                             \
+      typename Op::Vec vb = Op::Set1(-b);                               \
+      for (int r = 0; r < R; ++r) {                                     \
+        g[r] = Op::Fma(Op::Load(v + r * Op::kWidth), vb, g[r]);         \
+        Op::Store(g_e + r * Op::kWidth, g[r]);                          \
+      }                                                                 \
+    }                                                                   \
+  }
+
+DMLC_SPMM_DEFINE_KERNELS(Generic, )
+#ifdef DMLC_SPMM_X86
+DMLC_SPMM_DEFINE_KERNELS(AVX2, DMLC_SPMM_AVX2)
+DMLC_SPMM_DEFINE_KERNELS(AVX512, DMLC_SPMM_AVX512)
+#endif
+
+/**
+ * \brief returns the kernels for a dim with a simd level, or NULL if the dim
+ * is not specialized. The kernels of a higher level are used only if the CPU
+ * supports it.
+ */
+inline const Kernels* GetKernels(int dim, SimdLevel level = ActiveSimdLevel()) {
+  int d = dim == 4 ? 0 : dim == 8 ? 1 : dim == 16 ? 2 :
+          dim == 32 ? 3 : dim == 64 ? 4 : -1;
+  if (d < 0) return NULL;
+  static const Kernels generic[] = {
+    {EvaluateGeneric<4, GenericOp>, GradGeneric<4, GenericOp>},
+    {EvaluateGeneric<8, GenericOp>, GradGeneric<8, GenericOp>},
+    {EvaluateGeneric<16, GenericOp>, GradGeneric<16, GenericOp>},
+    {EvaluateGeneric<32, GenericOp>, GradGeneric<32, GenericOp>},
+    {EvaluateGeneric<64, GenericOp>, GradGeneric<64, GenericOp>}};
+#ifdef DMLC_SPMM_X86
+  // a dim smaller than a register uses the narrower kernels
+  static const Kernels avx2[] = {
+    {EvaluateAVX2<4, AVX2x4Op>, GradAVX2<4, AVX2x4Op>},
+    {EvaluateAVX2<8, AVX2x8Op>, GradAVX2<8, AVX2x8Op>},
+    {EvaluateAVX2<16, AVX2x8Op>, GradAVX2<16, AVX2x8Op>},
+    {EvaluateAVX2<32, AVX2x8Op>, GradAVX2<32, AVX2x8Op>},
+    {EvaluateAVX2<64, AVX2x8Op>, GradAVX2<64, AVX2x8Op>}};
+  static const Kernels avx512[] = {
+    avx2[0], avx2[1],
+    {EvaluateAVX512<16, AVX512x16Op>, GradAVX512<16, AVX512x16Op>},
+    {EvaluateAVX512<32, AVX512x16Op>, GradAVX512<32, AVX512x16Op>},
+    {EvaluateAVX512<64, AVX512x16Op>, GradAVX512<64, AVX512x16Op>}};
+  static const SimdLevel best = DetectSimdLevel();
+  if (level > best) level = best;
+  if (level == kAVX512) return &avx512[d];
+  if (level == kAVX2) return &avx2[d];
+#endif
+  return &generic[d];
+}
+
+}  // namespace spmm
+}  // namespace dmlc
@@ -1,5 +1,7 @@
 #pragma once
 #include <cstring>
+#include <algorithm>
+#include <vector>
 #include "dmlc/data.h"
 #include "dmlc/omp.h"
 namespace dmlc {
@@ -40,6 +42,166 @@ struct Range {
   size_t end;
 };
 
+/**
+ * \brief The rows of a sparse matrix divided into segments of about the same
+ * cost, which is the number of nonzeros plus one per row. So threads finish
+ * together even if the row lengths are skewed.
+ *
+ * It only reads D.offset. Init it once per matrix and pass it to all the
+ * products with that matrix.
+ */
+class RowSegments {
+ public:
+  RowSegments() { }
+  template <typename I>
+  RowSegments(const RowBlock<I>& D, int nparts) { Init(D, nparts); }
+
+  template <typename I>
+  void Init(const RowBlock<I>& D, int nparts) {
+    nparts = std::max(nparts, 1);
+    bound_.assign(nparts + 1, 0);
+    bound_[nparts] = D.size;
+    if (D.size == 0) return;
+    size_t base = D.offset[0];
+    size_t total = D.offset[D.size] - base + D.size;
+    size_t lo = 0;
+    for (int i = 1; i < nparts; ++i) {
+      // the first row whose starting cost reaches the target
+      size_t target = total * i / nparts, hi = D.size;
+      while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (D.offset[mid] - base + mid < target) lo = mid + 1; else hi = mid;
+      }
+      bound_[i] = lo;
+    }
+  }
+
+  /// \brief the number of segments
+  size_t size() const { return bound_.empty() ? 0 : bound_.size() - 1; }
+
+  /// \brief the rows of segment i
+  Range operator[](size_t i) const { return Range(bound_[i], bound_[i+1]); }
+
+ private:
+  std::vector<size_t> bound_;
+};
+
+/**
+ * \brief The transpose of a sparse matrix D, namely D in CSC, stored as a
+ * CSR matrix whose row k lists the rows of D having column k, in increasing
+ * order, with their values.
+ *
+ * D^T * x is then D' * x, which splits the columns of D among threads by nnz
+ * and visits each nonzero once, instead of every thread scanning all of D.
+ * Building it costs two passes over D, split among threads by the row
+ * segments of D, so it pays off when reused, such as for the gradients of
+ * both w and V of a minibatch. It keeps its own copy of the data, so D can be
+ * freed after Init.
+ */
+class TransposedSpMat {
+ public:
+  TransposedSpMat() : mat_() { }
+
+  /**
+   * \brief builds the transpose of D, whose column ids are less than ncols,
+   * and its row segments for nparts threads. The buffers of the previous
+   * matrix are reused
+   *
+   * @param rows the row segments of D, if NULL then computed for nparts. Each
+   * segment is counted and scattered by one thread
+   */
+  void Init(const RowBlock<unsigned>& D, size_t ncols, int nparts,
+            const RowSegments* rows = NULL) {
+    nparts = std::max(nparts, 1);
+    RowSegments tmp;
+    if (rows == NULL) { tmp.Init(D, nparts); rows = &tmp; }
+    // a counting sort by column id. cnt_[s*ncols+k] is the nnz of column k in
+    // the row segment s, and then where the segment starts in column k
+    const size_t nseg = rows->size();
+    cnt_.resize(nseg * ncols);
+#pragma omp parallel for num_threads(nparts) schedule(static, 1)
+    for (size_t s = 0; s < nseg; ++s) {
+      size_t* cnt = cnt_.data() + s * ncols;
+      std::fill(cnt, cnt + ncols, 0);
+      Range rg = (*rows)[s];
+      if (rg.begin == rg.end) continue;
+      for (size_t j = D.offset[rg.begin]; j < D.offset[rg.end]; ++j) {
+        CHECK_LT((size_t)D.index[j], ncols);
+        ++cnt[D.index[j]];
+      }
+    }
+
+    // the columns are split into nparts ranges. each range sums its column
+    // counts, then offsets them by the nnz of the previous ranges
+    offset_.resize(ncols + 1);
+    offset_[0] = 0;
+    std::vector<size_t> range_nnz(nparts + 1, 0);
+#pragma omp parallel for num_threads(nparts) schedule(static, 1)
+    for (int r = 0; r < nparts; ++r) {
+      Range rg = Range(0, ncols).Segment(r, nparts);
+      size_t sum = 0;
+      for (size_t k = rg.begin; k < rg.end; ++k) {
+        for (size_t s = 0; s < nseg; ++s) {
+          size_t c = cnt_[s * ncols + k];
+          cnt_[s * ncols + k] = sum;
+          sum += c;
+        }
+        offset_[k+1] = sum;
+      }
+      range_nnz[r+1] = sum;
+    }
+    for (int r = 0; r < nparts; ++r) range_nnz[r+1] += range_nnz[r];
+#pragma omp parallel for num_threads(nparts) schedule(static, 1)
+    for (int r = 0; r < nparts; ++r) {
+      Range rg = Range(0, ncols).Segment(r, nparts);
+      size_t base = range_nnz[r];
+      for (size_t k = rg.begin; k < rg.end; ++k) {
+        offset_[k+1] += base;
+        for (size_t s = 0; s < nseg; ++s) cnt_[s * ncols + k] += base;
+      }
+    }
+
+    // the segments scatter their rows in order, so the rows of a column are
+    // increasing
+    size_t nnz = offset_[ncols];
+    index_.resize(nnz);
+    value_.resize(D.value ? nnz : 0);
+#pragma omp parallel for num_threads(nparts) schedule(static, 1)
+    for (size_t s = 0; s < nseg; ++s) {
+      size_t* pos = cnt_.data() + s * ncols;
+      Range rg = (*rows)[s];
+      for (size_t i = rg.begin; i < rg.end; ++i) {
+        for (size_t j = D.offset[i]; j < D.offset[i+1]; ++j) {
+          size_t p = pos[D.index[j]]++;
+          index_[p] = (unsigned)i;
+          if (D.value) value_[p] = D.value[j];
+        }
+      }
+    }
+
+    mat_.size = ncols;
+    mat_.offset = offset_.data();
+    mat_.label = NULL;
+    mat_.weight = NULL;
+    mat_.index = index_.data();
+    mat_.value = D.value ? value_.data() : NULL;
+    seg_.Init(mat_, nparts);
+  }
+
+  /// \brief D' in CSR, which has one row per column of D
+  const RowBlock<unsigned>& mat() const { return mat_; }
+
+  /// \brief the rows of D', namely the columns of D, balanced by nnz
+  const RowSegments& segments() const { return seg_; }
+
+ private:
+  RowBlock<unsigned> mat_;
+  RowSegments seg_;
+  std::vector<size_t> offset_, cnt_;
+  std::vector<unsigned> index_;
+  std::vector<real_t> value_;
+};
+
 /**
  * \brief multi-thread sparse matrix vector multiplication
  */
@@ -49,31 +211,50 @@ class SpMV {
   using SpMat = RowBlock<unsigned>;
 
 
-  /** \brief y = D * x */
+  /**
+   * \brief y = D * x
+   *
+   * @param seg the row segments of D, if NULL then computed for nthreads
+   */
   template<typename V>
   static void Times(const SpMat& D, const std::vector<V>& x,
-                    std::vector<V>* y, int nthreads = kDefaultNT) {
+                    std::vector<V>* y, int nthreads = kDefaultNT,
+                    const RowSegments* seg = NULL) {
     CHECK_NOTNULL(y);
     CHECK_EQ(y->size(), D.size);
-    Times<V>(D, x.data(), y->data(), nthreads);
+    Times<V>(D, x.data(), y->data(), nthreads, seg);
   }
 
-  /** \brief y = D^T * x */
+  /**
+   * \brief y = D^T * x
+   *
+   * @param DT the transpose of D, if NULL then each thread accumulates a part
+   * of the rows into its own copy of y, and the copies are summed at the end
+   * @param seg the row segments of D without DT, if NULL then computed for
+   * nthreads
+   * @param buf the copies of y without DT, if NULL then allocated for this
+   * call. Passing the same buf for every minibatch reuses its memory
+   */
   template<typename V>
   static void TransTimes(const SpMat& D, const std::vector<V>& x,
-                    std::vector<V>* y, int nthreads = kDefaultNT) {
+                    std::vector<V>* y, int nthreads = kDefaultNT,
+                    const TransposedSpMat* DT = NULL,
+                    const RowSegments* seg = NULL,
+                    std::vector<V>* buf = NULL) {
     CHECK_EQ(x.size(), D.size);
     CHECK_NOTNULL(y);
-    TransTimes<V>(D, x.data(), y->data(), y->size(), nthreads);
+    TransTimes<V>(D, x.data(), y->data(), y->size(), nthreads, DT, seg, buf);
   }
 
   /** \brief y = D * x */
   template<typename V>
-  static void Times(const SpMat& D,  const V* const x, V* y, int nthreads = kDefaultNT) {
-#pragma omp parallel num_threads(nthreads)
-    {
-      Range rg = Range(0, D.size).Segment(
-          omp_get_thread_num(), omp_get_num_threads());
+  static void Times(const SpMat& D,  const V* const x, V* y, int nthreads = kDefaultNT,
+                    const RowSegments* seg = NULL) {
+    RowSegments tmp;
+    if (seg == NULL) { tmp.Init(D, nthreads); seg = &tmp; }
+#pragma omp parallel for num_threads(nthreads) schedule(static, 1)
+    for (size_t s = 0; s < seg->size(); ++s) {
+      Range rg = (*seg)[s];
 
       for (size_t i = rg.begin; i < rg.end; ++i) {
         if (D.offset[i] == D.offset[i+1]) continue;
@@ -93,29 +274,52 @@ class SpMV {
   /** \brief y = D^T * x */
   template<typename V>
   static void TransTimes(const SpMat& D,  const V* const x, V* y, size_t y_size,
-                         int nthreads = kDefaultNT) {
-#pragma omp parallel num_threads(nthreads)
-    {
-      Range rg = Range(0, y_size).Segment(
-          omp_get_thread_num(), omp_get_num_threads());
-      std::memset(y + rg.begin, 0, sizeof(V) * (rg.end - rg.begin));
+                         int nthreads = kDefaultNT,
+                         const TransposedSpMat* DT = NULL,
+                         const RowSegments* seg = NULL,
+                         std::vector<V>* buf = NULL) {
+    std::memset(y, 0, sizeof(V) * y_size);
+    if (DT) {
+      CHECK_EQ(DT->mat().size, y_size);
+      Times<V>(DT->mat(), x, y, nthreads, &DT->segments());
+      return;
+    }
 
-      for (size_t i = 0; i < D.size; ++i) {
-        if (D.offset[i] == D.offset[i+1]) continue;
+    RowSegments tmp_seg;
+    if (seg == NULL) { tmp_seg.Init(D, nthreads); seg = &tmp_seg; }
+    std::vector<V> tmp_buf;
+    if (buf == NULL) buf = &tmp_buf;
+    // segment 0 writes into y directly, segment s > 0 into buf[s-1]
+    size_t nseg = seg->size();
+    buf->assign((nseg - 1) * y_size, 0);
+#pragma omp parallel for num_threads(nthreads) schedule(static, 1)
+    for (size_t s = 0; s < nseg; ++s) {
+      Range rg = (*seg)[s];
+      V* y_s = s == 0 ? y : buf->data() + (s - 1) * y_size;
+      for (size_t i = rg.begin; i < rg.end; ++i) {
         V x_i = x[i];
         if (D.value) {
           for (size_t j = D.offset[i]; j < D.offset[i+1]; ++j) {
-            unsigned k = D.index[j];
-            if (rg.Has(k)) y[k] += x_i * D.value[j];
+            y_s[D.index[j]] += x_i * D.value[j];
           }
         } else {
           for (size_t j = D.offset[i]; j < D.offset[i+1]; ++j) {
-            unsigned k = D.index[j];
-            if (rg.Has(k)) y[k] += x_i;
+            y_s[D.index[j]] += x_i;
           }
         }
       }
     }
+    if (nseg <= 1) return;
+
+#pragma omp parallel num_threads(nthreads)
+    {
+      Range rg = Range(0, y_size).Segment(
+          omp_get_thread_num(), omp_get_num_threads());
+      for (size_t s = 1; s < nseg; ++s) {
+        const V* y_s = buf->data() + (s - 1) * y_size;
+        for (size_t k = rg.begin; k < rg.end; ++k) y[k] += y_s[k];
+      }
+    }
   }
 
 };
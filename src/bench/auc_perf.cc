@@ -0,0 +1,64 @@
+/**
+ * @file   auc_perf.cc
+ * @brief  error and time of AUCHistogram against the sorted AUC of
+ * BinClassEval, for margins of normal distributions of several separations and
+ * scales
+ *
+ * Usage: auc_perf -n 1000000 -pos 0.3
+ */
+#include <random>
+#include <algorithm>
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+#include "base/binary_class_evaluation.h"
+#include "base/now.h"
+
+DEFINE_int32(n, 1000000, "number of examples");
+DEFINE_double(pos, 0.3, "the fraction of positive examples");
+DEFINE_int32(nt, 1, "number of threads");
+
+using namespace dmlc;
+
+int main(int argc, char *argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  // the margins of the positive examples are N(mu, sigma) and the negative
+  // ones N(-mu, sigma)
+  double mus[] = {0.01, 0.1, 0.5, 1, 2, 4};
+  double sigmas[] = {0.5, 1, 4};
+  std::vector<float> label(FLAGS_n), py(FLAGS_n);
+  std::vector<double> hist(2 * AUCHistogram::kBuckets);
+
+  printf("%6s %6s %10s %10s %10s %10s %10s\n", "mu", "sigma", "sorted",
+         "histogram", "abs err", "sort sec", "hist sec");
+  double max_err = 0;
+  for (double sigma : sigmas) {
+    for (double mu : mus) {
+      std::mt19937 gen(0);
+      std::bernoulli_distribution is_pos(FLAGS_pos);
+      std::normal_distribution<float> noise(0, sigma);
+      for (int i = 0; i < FLAGS_n; ++i) {
+        label[i] = is_pos(gen) ? 1 : -1;
+        py[i] = label[i] * mu + noise(gen);
+      }
+      BinClassEval<float> eval(label.data(), py.data(), FLAGS_n, FLAGS_nt);
+
+      double start = Now();
+      double sorted = eval.AUC();
+      double t_sort = Now() - start;
+
+      start = Now();
+      std::fill(hist.begin(), hist.end(), 0);
+      eval.AddToAUCHistogram(hist.data(), hist.data() + AUCHistogram::kBuckets);
+      double approx = AUCHistogram::AUC(
+          hist.data(), hist.data() + AUCHistogram::kBuckets);
+      double t_hist = Now() - start;
+
+      double err = std::abs(approx - sorted);
+      max_err = std::max(max_err, err);
+      printf("%6.2f %6.1f %10.6f %10.6f %10.2g %10.4f %10.4f\n", mu, sigma,
+             sorted, approx, err, t_sort, t_hist);
+    }
+  }
+  printf("max abs err %.2g\n", max_err);
+  return 0;
+}
@@ -0,0 +1,88 @@
+/**
+ * @file   crb_perf.cc
+ * @brief  Converts a text dataset into CRB v1 (recordio), CRB v2 raw and CRB
+ * v2 LZ4, and reads each one back by parts through MinibatchIter
+ *
+ * Usage: crb_perf -data ../data/agaricus.txt.train -copies 100 -parts 4
+ */
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+#include "dmlc/recordio.h"
+#include "base/minibatch_iter.h"
+#include "base/now.h"
+
+DEFINE_string(data, "../data/agaricus.txt.train", "the input data");
+DEFINE_string(format, "libsvm", "the format of the input data");
+DEFINE_string(out, "/tmp/crb_perf", "the prefix of the converted files");
+DEFINE_int32(copies, 100, "write the input this many times");
+DEFINE_int32(block_rows, 10000, "number of rows per block");
+DEFINE_int32(parts, 4, "number of parts to read");
+DEFINE_int32(minibatch, 1000, "minibatch size");
+
+using namespace dmlc;
+using namespace dmlc::data;
+using Key = uint64_t;
+
+int main(int argc, char *argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  // load the data into blocks
+  std::vector<RowBlockContainer<Key>> blks(1);
+  {
+    MinibatchIter<Key> reader(FLAGS_data.c_str(), 0, 1, FLAGS_format.c_str(),
+                              FLAGS_block_rows);
+    reader.BeforeFirst();
+    while (reader.Next()) {
+      blks.back().Push(reader.Value());
+      if (blks.back().Size() >= (size_t)FLAGS_block_rows) blks.emplace_back();
+    }
+    if (blks.back().Size() == 0) blks.pop_back();
+  }
+  CHECK(!blks.empty()) << "no data in " << FLAGS_data;
+
+  // write them
+  std::string v1 = FLAGS_out + ".crb1", v2 = FLAGS_out + ".crb2",
+      v2z = FLAGS_out + ".crb2z";
+  {
+    Stream* f1 = Stream::Create(v1.c_str(), "w");
+    Stream* f2 = Stream::Create(v2.c_str(), "w");
+    Stream* f2z = Stream::Create(v2z.c_str(), "w");
+    RecordIOWriter w1(f1);
+    CRBWriter w2(f2, false), w2z(f2z, true);
+    CompressedRowBlock crb;
+    std::string str;
+    for (int c = 0; c < FLAGS_copies; ++c) {
+      for (const auto& b : blks) {
+        crb.Compress(b.GetBlock(), &str);
+        w1.WriteRecord(str);
+        w2.Write(b.GetBlock());
+        w2z.Write(b.GetBlock());
+      }
+    }
+    w2.Close(); w2z.Close();
+    delete f1; delete f2; delete f2z;
+  }
+
+  // read them by parts
+  printf("%8s %12s %12s %12s %14s\n",
+         "file", "MB on disk", "rows", "Mrows/s", "index checksum");
+  for (const auto& file : {v1, v2, v2z}) {
+    size_t rows = 0, bytes = 0;
+    Key sum = 0;
+    double start = Now();
+    for (int k = 0; k < FLAGS_parts; ++k) {
+      MinibatchIter<Key> reader(file.c_str(), k, FLAGS_parts, "crb",
+                                FLAGS_minibatch);
+      reader.BeforeFirst();
+      while (reader.Next()) {
+        const auto& mb = reader.Value();
+        rows += mb.size;
+        for (size_t i = 0; i < mb.offset[mb.size]; ++i) sum += mb.index[i];
+      }
+      bytes += reader.BytesRead();
+    }
+    double t = Now() - start;
+    printf("%8s %12.2f %12zu %12.2f %14llx\n", file.substr(file.rfind('.')+1).c_str(),
+           bytes / 1e6, rows, rows / t / 1e6, (unsigned long long)sum);
+  }
+  return 0;
+}
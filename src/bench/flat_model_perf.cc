@@ -0,0 +1,100 @@
+/**
+ * @file   flat_model_perf.cc
+ * @brief  startup and lookup time of a flat model against replaying the saved
+ * records into a hash map
+ *
+ * Usage: flat_model_perf -num_keys 10000000 -dim 16 -file /tmp/flat_model_perf
+ */
+#include <random>
+#include <unordered_map>
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+#include "base/flat_model.h"
+#include "base/now.h"
+
+DEFINE_uint64(num_keys, 10000000, "number of keys");
+DEFINE_int32(dim, 16, "embedding dimension");
+DEFINE_double(embedding_ratio, .1, "fraction of the keys with an embedding");
+DEFINE_int32(lookups, 10000000, "number of random lookups");
+DEFINE_string(file, "/tmp/flat_model_perf", "the name of the model files");
+
+using namespace dmlc;
+
+int main(int argc, char *argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  std::mt19937_64 gen(0);
+  std::uniform_real_distribution<float> dis(-1, 1);
+  std::vector<uint64_t> keys(FLAGS_num_keys);
+  for (auto& k : keys) k = gen();
+
+  // the records of the saved model and the flat model
+  std::string rec_file = FLAGS_file + ".rec", flat_file = FLAGS_file + ".flat";
+  double start = Now();
+  {
+    Stream* rec = CHECK_NOTNULL(Stream::Create(rec_file.c_str(), "w"));
+    Stream* fo = CHECK_NOTNULL(Stream::Create(flat_file.c_str(), "w"));
+    FlatModelWriter writer(fo);
+    std::vector<float> val(FLAGS_dim + 1);
+    std::string buf;
+    for (uint64_t k : keys) {
+      int len = dis(gen) < FLAGS_embedding_ratio * 2 - 1 ? FLAGS_dim + 1 : 1;
+      for (int i = 0; i < len; ++i) val[i] = dis(gen);
+      writer.Add(k, val.data(), len);
+      buf.append((char*)&k, sizeof(k));
+      buf.append((char*)&len, sizeof(len));
+      buf.append((char*)val.data(), len * sizeof(float));
+      if (buf.size() > (1 << 26)) { rec->Write(buf.data(), buf.size()); buf.clear(); }
+    }
+    rec->Write(buf.data(), buf.size());
+    writer.Close();
+    delete fo; delete rec;
+  }
+  printf("wrote %zu keys in %.2f sec\n", keys.size(), Now() - start);
+
+  std::uniform_int_distribution<size_t> pick(0, keys.size() - 1);
+  std::vector<uint64_t> query(FLAGS_lookups);
+  for (auto& q : query) q = pick(gen) % 2 ? keys[pick(gen)] : gen();
+
+  // replay the records into a hash map
+  start = Now();
+  std::unordered_map<uint64_t, std::vector<float>> map;
+  {
+    MappedFile f(rec_file);
+    const char* p = f.data(), *end = p + f.size();
+    while (p < end) {
+      uint64_t k; int len;
+      memcpy(&k, p, sizeof(k)); p += sizeof(k);
+      memcpy(&len, p, sizeof(len)); p += sizeof(len);
+      map[k].assign((const float*)p, (const float*)p + len);
+      p += len * sizeof(float);
+    }
+  }
+  double map_open = Now() - start;
+  start = Now();
+  double sum = 0;
+  for (uint64_t q : query) {
+    auto it = map.find(q);
+    if (it != map.end()) sum += it->second[0];
+  }
+  double map_lookup = Now() - start;
+
+  start = Now();
+  FlatModel model(flat_file);
+  double flat_open = Now() - start;
+  start = Now();
+  double flat_sum = 0;
+  for (uint64_t q : query) {
+    int len;
+    const float* v = model.Get(q, &len);
+    if (v) flat_sum += v[0];
+  }
+  double flat_lookup = Now() - start;
+  CHECK_EQ(sum, flat_sum);
+
+  printf("%18s %12s %16s\n", "", "open (ms)", "lookup (M/sec)");
+  printf("%18s %12.2f %16.2f\n", "replay into map", map_open * 1e3,
+         query.size() / map_lookup / 1e6);
+  printf("%18s %12.2f %16.2f\n", "flat model (mmap)", flat_open * 1e3,
+         query.size() / flat_lookup / 1e6);
+  return 0;
+}
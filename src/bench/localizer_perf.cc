@@ -0,0 +1,96 @@
+/**
+ * @file   localizer_perf.cc
+ * @brief  Sorting the (feature id, position) pairs of a minibatch with the
+ * comparison based ParallelSort and the RadixSorter used by Localizer, and the
+ * time of Localizer::Localize
+ *
+ * Usage: localizer_perf -rows 100000 -nt 2
+ */
+#include <random>
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+#include "base/localizer.h"
+#include "base/parallel_sort.h"
+#include "base/now.h"
+
+DEFINE_int32(rows, 100000, "number of examples in a minibatch");
+DEFINE_int32(nnz_per_row, 39, "number of features per example");
+DEFINE_uint64(uniq_keys, 10000000, "number of distinct feature ids");
+DEFINE_int32(nt, 2, "number of threads");
+DEFINE_int32(repeat, 10, "number of minibatches");
+
+namespace ps {
+// defined in ps-lite's manager.cc, which is not linked by this benchmark
+DEFINE_uint64(max_key, -1, "maximal global key");
+}  // namespace ps
+
+using namespace dmlc;
+using Key = uint64_t;
+
+#pragma pack(push)
+#pragma pack(4)
+struct Pair {
+  Key k; unsigned i;
+};
+#pragma pack(pop)
+
+int main(int argc, char *argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  // power-law distributed feature ids, which are hashed into 64 bits as the
+  // criteo parser does
+  std::mt19937_64 gen(0);
+  std::uniform_real_distribution<double> dis(0, 1);
+  std::vector<size_t> offset(1, 0);
+  std::vector<Key> index;
+  for (int i = 0; i < FLAGS_rows; ++i) {
+    for (int j = 0; j < FLAGS_nnz_per_row; ++j) {
+      Key id = (Key)(FLAGS_uniq_keys * pow(dis(gen), 3));
+      index.push_back(id * 0x9E3779B97F4A7C15ULL);
+    }
+    offset.push_back(index.size());
+  }
+  RowBlock<Key> blk;
+  blk.size = FLAGS_rows;
+  blk.offset = offset.data();
+  blk.index = index.data();
+  blk.label = NULL;
+  blk.value = NULL;
+
+  std::vector<Pair> pairs(index.size());
+  for (size_t i = 0; i < index.size(); ++i) {
+    pairs[i].k = ReverseBytes(index[i]);
+    pairs[i].i = i;
+  }
+
+  double t_cmp = 0, t_radix = 0, t_localize = 0;
+  size_t num_uniq = 0;
+  RadixSorter<Pair> sorter(FLAGS_nt);
+  Localizer<Key> lc(FLAGS_nt);
+  for (int r = 0; r < FLAGS_repeat; ++r) {
+    auto a = pairs;
+    double start = Now();
+    ParallelSort(&a, FLAGS_nt,
+                 [](const Pair& x, const Pair& y) { return x.k < y.k; });
+    t_cmp += Now() - start;
+
+    auto b = pairs;
+    start = Now();
+    sorter.Sort(&b, [](const Pair& x) { return x.k; });
+    t_radix += Now() - start;
+    for (size_t i = 0; i < a.size(); ++i) CHECK_EQ(a[i].k, b[i].k);
+
+    data::RowBlockContainer<unsigned> localized;
+    std::vector<Key> uniq;
+    std::vector<unsigned> cnt;
+    start = Now();
+    lc.Localize(blk, &localized, &uniq, &cnt);
+    t_localize += Now() - start;
+    num_uniq = uniq.size();
+  }
+  double n = (double)index.size() * FLAGS_repeat;
+  printf("%zu pairs, %zu unique keys per minibatch\n", index.size(), num_uniq);
+  printf("ParallelSort  %8.2f Mkeys/s\n", n / t_cmp / 1e6);
+  printf("RadixSorter   %8.2f Mkeys/s\n", n / t_radix / 1e6);
+  printf("Localize      %8.2f Mkeys/s\n", n / t_localize / 1e6);
+  return 0;
+}
@@ -0,0 +1,72 @@
+/**
+ * @file   math_perf.cc
+ * @brief  throughput and max error of fastmath::Exp, Log1pExp and Sigmoid for
+ * each SIMD level the CPU supports, against libm
+ *
+ * Usage: math_perf -n 10000000 -range 50
+ */
+#include <random>
+#include <algorithm>
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+#include "base/fast_math.h"
+#include "base/now.h"
+
+DEFINE_int32(n, 10000000, "number of values");
+DEFINE_double(range, 50, "the values are uniform in [-range, range]");
+DEFINE_int32(nt, 1, "number of threads");
+DEFINE_int32(repeat, 5, "number of runs per function");
+
+using namespace dmlc;
+
+// the exact results in double
+double Exp(double x) { return exp(x); }
+double Log1pExp(double x) {
+  return x > 0 ? x + log1p(exp(-x)) : log1p(exp(x));
+}
+double Sigmoid(double x) { return 1 / (1 + exp(-x)); }
+
+// max |a - b| / max(|b|, 1), exp is compared only where float does not overflow
+double MaxErr(const std::vector<float>& x, const std::vector<float>& y,
+              double (*f)(double)) {
+  double d = 0;
+  for (size_t i = 0; i < x.size(); ++i) {
+    if (f == Exp && (x[i] < -87 || x[i] > 88)) continue;
+    double r = f(x[i]);
+    double scale = f == Exp ? r : std::max(std::abs(r), 1.0);
+    d = std::max(d, std::abs(y[i] - r) / scale);
+  }
+  return d;
+}
+
+int main(int argc, char *argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  std::mt19937 gen(0);
+  std::uniform_real_distribution<float> dis(-FLAGS_range, FLAGS_range);
+  std::vector<float> x(FLAGS_n), y(FLAGS_n);
+  for (auto& v : x) v = dis(gen);
+
+  typedef void (*Func)(const float*, float*, size_t, int);
+  const char* names[] = {"exp", "log1pexp", "sigmoid"};
+  Func funcs[] = {fastmath::Exp<float>, fastmath::Log1pExp<float>,
+                  fastmath::Sigmoid<float>};
+  double (*exact[])(double) = {Exp, Log1pExp, Sigmoid};
+  const char* levels[] = {"generic", "avx2", "avx512"};
+  spmm::SimdLevel best = spmm::DetectSimdLevel();
+
+  printf("%9s %8s %10s %12s\n", "func", "kernel", "M/sec", "max err");
+  for (int f = 0; f < 3; ++f) {
+    for (int l = -1; l <= best; ++l) {
+      fastmath::UseLibm() = l < 0;
+      if (l >= 0) spmm::ActiveSimdLevel() = (spmm::SimdLevel)l;
+      double start = Now();
+      for (int r = 0; r < FLAGS_repeat; ++r) {
+        funcs[f](x.data(), y.data(), x.size(), FLAGS_nt);
+      }
+      double t = (Now() - start) / FLAGS_repeat;
+      printf("%9s %8s %10.1f %12.2g\n", names[f], l < 0 ? "libm" : levels[l],
+             x.size() / t / 1e6, MaxErr(x, y, exact[f]));
+    }
+  }
+  return 0;
+}
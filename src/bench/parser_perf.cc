@@ -0,0 +1,103 @@
+/**
+ * @file   parser_perf.cc
+ * @brief  Parsing throughput of criteo and adfea text data with different
+ * numbers of threads
+ *
+ * Usage: parser_perf -rows 1000000 -max_threads 4
+ */
+#include <random>
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+#include "base/criteo_parser.h"
+#include "base/adfea_parser.h"
+#include "base/now.h"
+
+DEFINE_int32(rows, 1000000, "number of examples to generate");
+DEFINE_int32(max_threads, 4, "the largest number of threads to try");
+DEFINE_string(out, "/tmp/parser_perf", "the prefix of the generated files");
+
+using namespace dmlc;
+using namespace dmlc::data;
+using Key = uint64_t;
+
+// writes criteo-like data: label, 13 integers and 26 hashed categories, some
+// of them missing
+void WriteCriteo(const std::string& file) {
+  std::mt19937 gen(0);
+  FILE* fo = fopen(file.c_str(), "w");
+  CHECK_NOTNULL(fo);
+  for (int r = 0; r < FLAGS_rows; ++r) {
+    fprintf(fo, "%d", (int)(gen() % 4 == 0));
+    for (int i = 0; i < 13; ++i) {
+      if (gen() % 5) fprintf(fo, "\t%u", (unsigned)(gen() % 1000));
+      else fprintf(fo, "\t");
+    }
+    for (int i = 0; i < 26; ++i) {
+      if (gen() % 5) fprintf(fo, "\t%08x", (unsigned)(gen() % 100000));
+      else fprintf(fo, "\t");
+    }
+    fprintf(fo, "\n");
+  }
+  fclose(fo);
+}
+
+// writes adfea data: line id, count, label, and feature:group pairs
+void WriteAdfea(const std::string& file) {
+  std::mt19937 gen(0);
+  FILE* fo = fopen(file.c_str(), "w");
+  CHECK_NOTNULL(fo);
+  for (int r = 0; r < FLAGS_rows; ++r) {
+    fprintf(fo, "%d 1 %d", r, (int)(gen() % 4 == 0));
+    for (int i = 0; i < 30; ++i) {
+      fprintf(fo, " %u:%d", (unsigned)(gen() % 10000000), i);
+    }
+    fprintf(fo, "\n");
+  }
+  fclose(fo);
+}
+
+// reads all rows, returns the number of rows and a checksum of the indices
+// and their rows
+void Read(Parser<Key>* parser, size_t* rows, Key* sum) {
+  *rows = 0; *sum = 0;
+  parser->BeforeFirst();
+  while (parser->Next()) {
+    const auto& blk = parser->Value();
+    for (size_t i = 0; i < blk.size; ++i) {
+      ++ *rows;
+      for (size_t j = blk.offset[i]; j < blk.offset[i+1]; ++j) {
+        *sum += blk.index[j] * *rows;
+      }
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  std::string criteo = FLAGS_out + ".criteo", adfea = FLAGS_out + ".adfea";
+  WriteCriteo(criteo);
+  WriteAdfea(adfea);
+
+  printf("%8s %8s %10s %10s %12s\n", "format", "threads", "MB/s", "rows",
+         "checksum");
+  for (const auto& format : {"criteo", "adfea"}) {
+    std::string file = FLAGS_out + "." + format;
+    for (int nt = 1; nt <= FLAGS_max_threads; nt *= 2) {
+      InputSplit* split = InputSplit::Create(file.c_str(), 0, 1, "text");
+      Parser<Key>* parser;
+      if (!strcmp(format, "criteo")) {
+        parser = new CriteoParser<Key>(split, true, nt);
+      } else {
+        parser = new AdfeaParser<Key>(split, nt);
+      }
+      size_t rows; Key sum;
+      double start = Now();
+      Read(parser, &rows, &sum);
+      double t = Now() - start;
+      printf("%8s %8d %10.1f %10zu %12llx\n", format, nt,
+             parser->BytesRead() / t / 1e6, rows, (unsigned long long)sum);
+      delete parser;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,122 @@
+/**
+ * @file   predict_out_perf.cc
+ * @brief  throughput of writing predictions by ostream, snprintf and
+ * PredictionWriter, as text and as binary
+ *
+ * Usage: predict_out_perf -rows 10000000 -minibatch 100000 -threads 4
+ */
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <atomic>
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+#include "dmlc/io.h"
+#include "base/prediction_writer.h"
+#include "base/now.h"
+
+DEFINE_int32(rows, 10000000, "number of predictions");
+DEFINE_int32(minibatch, 100000, "number of predictions per minibatch");
+DEFINE_int32(threads, 4, "number of threads giving the minibatches");
+DEFINE_string(file, "/tmp/predict_out_perf", "the name of the output files");
+
+using namespace dmlc;
+
+std::string ReadAll(const std::string& file) {
+  Stream* fi = CHECK_NOTNULL(Stream::Create(file.c_str(), "r"));
+  std::string s, buf(1 << 20, 0);
+  size_t n;
+  while ((n = fi->Read(&buf[0], buf.size())) > 0) s.append(buf.data(), n);
+  delete fi;
+  return s;
+}
+
+int main(int argc, char *argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  // probabilities and margins
+  std::mt19937 gen(0);
+  std::uniform_real_distribution<float> dis(0, 1);
+  std::normal_distribution<float> margin(0, 3);
+  std::vector<float> py(FLAGS_rows);
+  for (int i = 0; i < FLAGS_rows; ++i) py[i] = i % 2 ? dis(gen) : margin(gen);
+  int num_mb = (FLAGS_rows + FLAGS_minibatch - 1) / FLAGS_minibatch;
+  auto mb_begin = [](int k) { return (size_t)k * FLAGS_minibatch; };
+  auto mb_size = [&](int k) {
+    return std::min((size_t)FLAGS_rows - mb_begin(k), (size_t)FLAGS_minibatch);
+  };
+
+  printf("%34s %10s %12s\n", "", "sec", "rows/sec");
+  auto report = [](const char* name, double sec) {
+    printf("%34s %10.3f %12.0f\n", name, sec, FLAGS_rows / sec);
+  };
+
+  std::string ref = FLAGS_file + ".ostream";
+  double start = Now();
+  {
+    Stream* fo = CHECK_NOTNULL(Stream::Create(ref.c_str(), "w"));
+    {
+      ostream os(fo);
+      for (float p : py) os << p << "\n";
+    }
+    delete fo;
+  }
+  report("ostream", Now() - start);
+
+  std::string file = FLAGS_file + ".snprintf";
+  start = Now();
+  {
+    Stream* fo = CHECK_NOTNULL(Stream::Create(file.c_str(), "w"));
+    std::string s;
+    char buf[32];
+    for (int k = 0; k < num_mb; ++k) {
+      s.clear();
+      for (size_t i = mb_begin(k); i < mb_begin(k) + mb_size(k); ++i) {
+        s.append(buf, snprintf(buf, sizeof(buf), "%g\n", py[i]));
+      }
+      fo->Write(s.data(), s.size());
+    }
+    delete fo;
+  }
+  report("snprintf", Now() - start);
+  CHECK(ReadAll(ref) == ReadAll(file));
+
+  // the minibatches are given by the threads in a shuffled order
+  std::vector<int> order(num_mb);
+  for (int k = 0; k < num_mb; ++k) order[k] = k;
+  std::shuffle(order.begin(), order.end(), gen);
+  for (bool binary : {false, true}) {
+    for (int nt : {1, FLAGS_threads}) {
+      file = FLAGS_file + (binary ? ".bin" : ".txt");
+      start = Now();
+      {
+        Stream* fo = CHECK_NOTNULL(Stream::Create(file.c_str(), "w"));
+        PredictionWriter writer(fo, binary);
+        std::atomic<int> next(0);
+        std::vector<std::thread> thr;
+        for (int t = 0; t < nt; ++t) {
+          thr.emplace_back([&]() {
+              for (int i; (i = next++) < num_mb; ) {
+                int k = order[i];
+                writer.Write(k, py.data() + mb_begin(k), mb_size(k));
+              }
+            });
+        }
+        for (auto& t : thr) t.join();
+        CHECK_EQ(writer.num_written(), (size_t)num_mb);
+        delete fo;
+      }
+      std::string name = std::string("PredictionWriter ") +
+                         (binary ? "binary" : "text") + ", " +
+                         std::to_string(nt) + " threads";
+      report(name.c_str(), Now() - start);
+      std::string out = ReadAll(file);
+      if (binary) {
+        CHECK_EQ(out.size(), py.size() * sizeof(float));
+        CHECK(!memcmp(out.data(), py.data(), out.size()));
+      } else {
+        CHECK(ReadAll(ref) == out);
+      }
+    }
+  }
+  return 0;
+}
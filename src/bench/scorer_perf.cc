@@ -0,0 +1,86 @@
+/**
+ * @file   scorer_perf.cc
+ * @brief  latency of Scorer for requests of 1 to 1000 rows, by p50, p99 and
+ * max over the requests
+ *
+ * Usage: scorer_perf -num_keys 10000000 -dim 16 -nnz 39 -requests 1000
+ */
+#include <random>
+#include <algorithm>
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+#include "base/scorer.h"
+#include "base/now.h"
+
+DEFINE_uint64(num_keys, 10000000, "number of keys in the model");
+DEFINE_int32(dim, 16, "embedding dimension");
+DEFINE_double(embedding_ratio, .1, "fraction of the keys with an embedding");
+DEFINE_int32(nnz, 39, "number of features per row");
+DEFINE_int32(requests, 1000, "number of requests per batch size");
+DEFINE_string(file, "/tmp/scorer_perf.flat", "the model file");
+
+using namespace dmlc;
+
+int main(int argc, char *argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  std::mt19937_64 gen(0);
+  std::uniform_real_distribution<float> dis(-1, 1);
+  {
+    // feature ids 0, 1, ..., num_keys - 1
+    Stream* fo = CHECK_NOTNULL(Stream::Create(FLAGS_file.c_str(), "w"));
+    FlatModelWriter writer(fo);
+    std::vector<float> val(FLAGS_dim + 1);
+    for (uint64_t id = 0; id < FLAGS_num_keys; ++id) {
+      int len = dis(gen) < FLAGS_embedding_ratio * 2 - 1 ? FLAGS_dim + 1 : 1;
+      for (int i = 0; i < len; ++i) val[i] = dis(gen) * .1;
+      writer.Add(ReverseBytes(id), val.data(), len);
+    }
+    writer.Close();
+    delete fo;
+  }
+
+  double start = Now();
+  FlatModel model(FLAGS_file);
+  Scorer scorer(model);
+  printf("opened %zu keys in %.3f ms\n", model.size(), (Now() - start) * 1e3);
+
+  // requests of binary rows with uniformly random feature ids, 1% of them
+  // not in the model
+  std::uniform_int_distribution<uint64_t> fea(0, FLAGS_num_keys * 1.01);
+  std::vector<float> py(1000);
+  printf("%6s %10s %10s %10s %12s\n", "rows", "p50 (us)", "p99 (us)",
+         "max (us)", "rows/sec");
+  for (int rows : {1, 10, 100, 1000}) {
+    std::vector<size_t> offset(rows + 1);
+    for (int i = 0; i <= rows; ++i) offset[i] = (size_t)i * FLAGS_nnz;
+    std::vector<real_t> label(rows, 0);
+    std::vector<uint64_t> index;
+    std::vector<double> latency(FLAGS_requests);
+    // a warm up pass pages the touched parts of the model in
+    for (int pass = 0; pass < 2; ++pass) {
+      std::mt19937_64 req_gen(rows);
+      for (int r = 0; r < FLAGS_requests; ++r) {
+        index.resize(offset[rows]);
+        for (auto& id : index) id = fea(req_gen);
+        RowBlock<uint64_t> blk;
+        blk.size = rows;
+        blk.offset = offset.data();
+        blk.label = label.data();
+        blk.weight = NULL;
+        blk.index = index.data();
+        blk.value = NULL;
+        double t = Now();
+        scorer.Score(blk, py.data(), true);
+        latency[r] = Now() - t;
+      }
+    }
+    double total = 0;
+    for (double t : latency) total += t;
+    std::sort(latency.begin(), latency.end());
+    printf("%6d %10.1f %10.1f %10.1f %12.0f\n", rows,
+           latency[latency.size() / 2] * 1e6,
+           latency[latency.size() * 99 / 100] * 1e6, latency.back() * 1e6,
+           rows * latency.size() / total);
+  }
+  return 0;
+}
@@ -0,0 +1,220 @@
+/**
+ * @file   spmm_perf.cc
+ * @brief  GFLOP/s of the fused FM evaluate and gradient kernels of
+ * spmm_simd.h on Criteo-like minibatches, for each SIMD level the CPU supports,
+ * and the per-thread imbalance of splitting the rows evenly or by nnz
+ *
+ * Usage: spmm_perf -rows 100000 -cols 1000000 -nt 4 -skew 1
+ */
+#include <random>
+#include <algorithm>
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+#include "dmlc/omp.h"
+#include "base/spmv.h"
+#include "base/spmm_simd.h"
+#include "base/now.h"
+
+DEFINE_int32(rows, 100000, "number of examples in a minibatch");
+DEFINE_int32(nnz_per_row, 39, "number of features per example");
+DEFINE_int32(cols, 1000000, "number of unique features in a minibatch");
+DEFINE_bool(binary, true, "feature values are all 1 as criteo");
+DEFINE_int32(nt, 1, "number of threads");
+DEFINE_int32(repeat, 5, "number of runs per kernel");
+DEFINE_double(skew, 0, "if > 0, row lengths are lognormal with this sigma");
+
+using namespace dmlc;
+
+/// \brief a minibatch with power-law distributed feature ids
+struct Minibatch {
+  Minibatch() {
+    std::mt19937 gen(0);
+    std::uniform_real_distribution<double> dis(0, 1);
+    // mean nnz_per_row
+    std::lognormal_distribution<double> len_dis(
+        log(FLAGS_nnz_per_row) - FLAGS_skew * FLAGS_skew / 2, FLAGS_skew);
+    offset.push_back(0);
+    for (int i = 0; i < FLAGS_rows; ++i) {
+      int len = FLAGS_nnz_per_row;
+      if (FLAGS_skew > 0) {
+        len = std::min(std::max((int)len_dis(gen), 1), FLAGS_cols);
+      }
+      for (int j = 0; j < len; ++j) {
+        // a few hot features and a long tail
+        index.push_back((unsigned)(FLAGS_cols * pow(dis(gen), 3)));
+        value.push_back(dis(gen));
+      }
+      std::sort(index.end() - len, index.end());
+      offset.push_back(index.size());
+    }
+    D.size = FLAGS_rows;
+    D.offset = offset.data();
+    D.index = index.data();
+    D.value = FLAGS_binary ? NULL : value.data();
+  }
+  RowBlock<unsigned> D;
+  std::vector<size_t> offset;
+  std::vector<unsigned> index;
+  std::vector<real_t> value;
+};
+
+// py = X * w + .5 * sum((X*V).^2 - (X.*X)*(V.*V), 2) and XV = X * V with
+// runtime dim, the code of difacto::Loss without the simd kernels
+void EvaluateRef(const RowBlock<unsigned>& D, const std::vector<real_t>& w,
+                 const std::vector<unsigned>& col_map,
+                 const std::vector<real_t>& V, int dim,
+                 std::vector<real_t>* XV, std::vector<real_t>* py) {
+  XV->assign(D.size * dim, 0);
+  py->resize(D.size);
+  for (size_t i = 0; i < D.size; ++i) {
+    real_t* xv = XV->data() + i * dim;
+    real_t lin = 0, xxvv = 0;
+    for (size_t j = D.offset[i]; j < D.offset[i+1]; ++j) {
+      real_t x = D.value ? D.value[j] : 1;
+      lin += x * w[D.index[j]];
+      unsigned e = col_map[D.index[j]];
+      if (e == spmm::kNoEmbedding) continue;
+      const real_t* v = V.data() + (size_t)e * dim;
+      real_t vv = 0;
+      for (int k = 0; k < dim; ++k) {
+        xv[k] += x * v[k];
+        vv += v[k] * v[k];
+      }
+      xxvv += x * x * vv;
+    }
+    real_t s = 0;
+    for (int k = 0; k < dim; ++k) s += xv[k] * xv[k];
+    (*py)[i] = lin + .5 * (s - xxvv);
+  }
+}
+
+// grad = X' * diag(p) * XV - diag((X.*X)'*p) * V with runtime dim
+void GradRef(const RowBlock<unsigned>& D, const std::vector<unsigned>& col_map,
+             const std::vector<real_t>& p, const std::vector<real_t>& XV,
+             const std::vector<real_t>& V, int dim, std::vector<real_t>* grad) {
+  std::fill(grad->begin(), grad->end(), 0);
+  for (size_t i = 0; i < D.size; ++i) {
+    const real_t* xv = XV.data() + i * dim;
+    for (size_t j = D.offset[i]; j < D.offset[i+1]; ++j) {
+      unsigned e = col_map[D.index[j]];
+      if (e == spmm::kNoEmbedding) continue;
+      real_t x = D.value ? D.value[j] : 1;
+      real_t a = p[i] * x;
+      real_t* g = grad->data() + (size_t)e * dim;
+      const real_t* v = V.data() + (size_t)e * dim;
+      for (int k = 0; k < dim; ++k) g[k] += a * xv[k] - a * x * v[k];
+    }
+  }
+}
+
+// max / mean of the nnz of the nt parts
+double Imbalance(const RowBlock<unsigned>& D, const std::vector<Range>& parts) {
+  double max = 0, sum = 0;
+  for (const auto& rg : parts) {
+    double nnz = D.offset[rg.end] - D.offset[rg.begin];
+    max = std::max(max, nnz);
+    sum += nnz;
+  }
+  return sum > 0 ? max / (sum / parts.size()) : 1;
+}
+
+real_t MaxDiff(const std::vector<real_t>& a, const std::vector<real_t>& b) {
+  CHECK_EQ(a.size(), b.size());
+  real_t d = 0;
+  for (size_t i = 0; i < a.size(); ++i) {
+    d = std::max(d, std::abs(a[i] - b[i]) / (1 + std::abs(b[i])));
+  }
+  return d;
+}
+
+int main(int argc, char *argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  Minibatch mb;
+  const auto& D = mb.D;
+  double flops = D.offset[D.size];
+  const char* names[] = {"generic", "avx2", "avx512"};
+  spmm::SimdLevel best = spmm::DetectSimdLevel();
+
+  TransposedSpMat DT;
+  double start = Now();
+  DT.Init(D, FLAGS_cols, FLAGS_nt);
+  printf("build the transpose: %.3f sec\n\n", Now() - start);
+
+  // a quarter of the columns have no embedding
+  std::vector<unsigned> col_map(FLAGS_cols);
+  for (unsigned c = 0; c < col_map.size(); ++c) {
+    col_map[c] = c % 4 == 3 ? spmm::kNoEmbedding : c;
+  }
+  std::mt19937 gen(0);
+  std::uniform_real_distribution<real_t> dis(-1, 1);
+  std::vector<real_t> w(FLAGS_cols), p(D.size);
+  for (auto& v : w) v = dis(gen);
+  for (auto& v : p) v = dis(gen);
+  RowSegments rows(D, FLAGS_nt);
+  const auto& XT = DT.mat();
+  const auto& cols = DT.segments();
+
+  printf("%4s %8s %18s %18s %12s\n", "dim", "kernel", "evaluate GFLOP/s",
+         "grad GFLOP/s", "max diff");
+  for (int dim : {4, 8, 16, 32, 64}) {
+    std::vector<real_t> V(FLAGS_cols * dim);
+    for (auto& v : V) v = dis(gen);
+    std::vector<real_t> XV(D.size * dim), XV_ref, py(D.size), py_w(D.size),
+        py_ref, grad(V.size()), grad_ref(V.size());
+
+    start = Now();
+    for (int r = 0; r < FLAGS_repeat; ++r) {
+      EvaluateRef(D, w, col_map, V, dim, &XV_ref, &py_ref);
+    }
+    double t1 = (Now() - start) / FLAGS_repeat;
+    start = Now();
+    for (int r = 0; r < FLAGS_repeat; ++r) {
+      GradRef(D, col_map, p, XV_ref, V, dim, &grad_ref);
+    }
+    double t2 = (Now() - start) / FLAGS_repeat;
+    // evaluate has 4 flops per nonzero and dim, grad has 2
+    printf("%4d %8s %18.2f %18.2f\n", dim, "scalar",
+           4 * flops * dim / t1 / 1e9, 2 * flops * dim / t2 / 1e9);
+
+    for (int l = spmm::kGeneric; l <= best; ++l) {
+      const spmm::Kernels* k = spmm::GetKernels(dim, (spmm::SimdLevel)l);
+      start = Now();
+      for (int r = 0; r < FLAGS_repeat; ++r) {
+#pragma omp parallel for num_threads(FLAGS_nt) schedule(static, 1)
+        for (size_t s = 0; s < rows.size(); ++s) {
+          k->evaluate(D.offset, D.index, D.value, rows[s].begin, rows[s].end,
+                      w.data(), col_map.data(), V.data(), XV.data(),
+                      py_w.data(), py.data());
+        }
+      }
+      t1 = (Now() - start) / FLAGS_repeat;
+      start = Now();
+      for (int r = 0; r < FLAGS_repeat; ++r) {
+        std::fill(grad.begin(), grad.end(), 0);
+#pragma omp parallel for num_threads(FLAGS_nt) schedule(static, 1)
+        for (size_t s = 0; s < cols.size(); ++s) {
+          k->grad(XT.offset, XT.index, XT.value, cols[s].begin, cols[s].end,
+                  col_map.data(), p.data(), XV_ref.data(), V.data(),
+                  grad.data());
+        }
+      }
+      t2 = (Now() - start) / FLAGS_repeat;
+      real_t diff = std::max(MaxDiff(XV, XV_ref), MaxDiff(py, py_ref));
+      diff = std::max(diff, MaxDiff(grad, grad_ref));
+      printf("%4d %8s %18.2f %18.2f %12.2g\n", dim, names[l],
+             4 * flops * dim / t1 / 1e9, 2 * flops * dim / t2 / 1e9, diff);
+    }
+  }
+
+  printf("\n%8s %18s %18s\n", "threads", "even rows max/avg", "by nnz max/avg");
+  for (int nt = 2; nt <= std::max(FLAGS_nt, 2); nt *= 2) {
+    RowSegments seg(D, nt);
+    std::vector<Range> even, by_nnz;
+    for (int i = 0; i < nt; ++i) {
+      even.push_back(Range(0, D.size).Segment(i, nt));
+      by_nnz.push_back(seg[i]);
+    }
+    printf("%8d %18.3f %18.3f\n", nt, Imbalance(D, even), Imbalance(D, by_nnz));
+  }
+  return 0;
+}
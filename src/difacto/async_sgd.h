@@ -1,8 +1,12 @@
 #pragma once
+#include <array>
+#include <atomic>
 #include "progress.h"
 #include "config.pb.h"
 #include "loss.h"
 #include "base/localizer.h"
+#include "base/object_pool.h"
+#include "base/slab_arena.h"
 #include "solver/minibatch_solver.h"
 
 namespace dmlc {
@@ -96,8 +100,8 @@ struct ISGDHandle {
 
   // statistic
   bool push_count;
-  static int64_t new_w;
-  static int64_t new_V;
+  static std::atomic<int64_t> new_w;
+  static std::atomic<int64_t> new_V;
   std::function<void(const Progress& prog)> reporter;
 
   void Load(Stream* fi) { }
@@ -129,6 +133,54 @@ struct ISGDHandle {
   int ct_ = 0, ns_ = 0;
 };
 
+/**
+ * \brief storage of w, V and the AdaGrad states for features with embeddings
+ *
+ * A feature with a length-n w (namely w_0 and a length-(n-1) V) occupies one
+ * slot in the arena of size class n, instead of two separately allocated
+ * arrays. A slot is [w_0, ..., w_{n-1}, sqc_grad_0, z_0, sqc_grad_1, ...,
+ * sqc_grad_{n-1}], namely w followed by sqc_grad (see \ref AdaGradEntry).
+ */
+class EmbeddingStore {
+ public:
+  static const int kMaxSize = 1024;
+  /// \brief the largest embedding dimension, w is 1 + dim long
+  static const int kMaxDim = kMaxSize - 2;
+  EmbeddingStore() { for (auto& a : arena_) a = NULL; }
+  ~EmbeddingStore() { for (auto& a : arena_) delete a.load(); }
+
+  /// \brief allocate a slot for a length-n w
+  inline uint32_t Alloc(int n) { return Arena(n)->Alloc(); }
+
+  /// \brief free a slot allocated by \ref Alloc
+  inline void Free(int n, uint32_t slot) { Arena(n)->Free(slot); }
+
+  /// \brief returns the slot content
+  inline float* Get(int n, uint32_t slot) const {
+    return arena_[n].load(std::memory_order_relaxed)->Get(slot);
+  }
+
+  /// \brief the number of bytes allocated by all size classes
+  size_t MemCostBytes() const {
+    size_t bytes = 0;
+    for (const auto& a : arena_) if (a.load()) bytes += a.load()->MemCostBytes();
+    return bytes;
+  }
+
+ private:
+  SlabArena<float>* Arena(int n) {
+    CHECK_GT(n, 1); CHECK_LT(n, kMaxSize);
+    SlabArena<float>* a = arena_[n].load();
+    if (a) return a;
+    std::lock_guard<std::mutex> lk(mu_);
+    a = arena_[n].load();
+    if (!a) { a = new SlabArena<float>(2 * n + 1); arena_[n].store(a); }
+    return a;
+  }
+  std::array<std::atomic<SlabArena<float>*>, kMaxSize> arena_;
+  std::mutex mu_;
+};
+
 /**
  * \brief value stored on server nodes
  */
@@ -136,46 +188,69 @@ struct AdaGradEntry {
   AdaGradEntry() { }
   ~AdaGradEntry() { Clear(); }
 
+  AdaGradEntry(const AdaGradEntry&) = delete;
+  AdaGradEntry& operator=(const AdaGradEntry&) = delete;
+  AdaGradEntry(AdaGradEntry&& other) { *this = std::move(other); }
+  AdaGradEntry& operator=(AdaGradEntry&& other) {
+    if (this == &other) return *this;
+    Clear();
+    fea_cnt = other.fea_cnt; size = other.size; slot_ = other.slot_;
+    w0_ = other.w0_; cg0_[0] = other.cg0_[0]; cg0_[1] = other.cg0_[1];
+    other.size = 1;
+    return *this;
+  }
+
   inline void Clear() {
-    if ( size > 1 ) { delete [] w; delete [] sqc_grad; }
-    size = 0; w = NULL; sqc_grad = NULL;
+    if (size > 1) store.Free(size, slot_);
+    size = 1; w0_ = cg0_[0] = cg0_[1] = 0;
   }
 
   inline void Resize(int n) {
-    if (n < size) { size = n; return; }
-
-    float* new_w = new float[n]; float* new_cg = new float[n+1];
-    if (size == 1) {
-      new_w[0] = w_0(); new_cg[0] = sqc_grad_0(); new_cg[1] = z_0();
-    } else {
-      memcpy(new_w, w, size * sizeof(float));
-      memcpy(new_cg, sqc_grad, (size+1) * sizeof(float));
-      Clear();
+    if (n == size) return;
+    float* old_w = w(); float* old_cg = sqc_grad();
+    if (n == 1) {
+      w0_ = old_w[0]; cg0_[0] = old_cg[0]; cg0_[1] = old_cg[1];
+      store.Free(size, slot_); size = 1;
+      return;
     }
-    w = new_w; sqc_grad = new_cg; size = n;
+    uint32_t new_slot = store.Alloc(n);
+    float* new_w = store.Get(n, new_slot); float* new_cg = new_w + n;
+    int m = std::min(n, size);
+    memcpy(new_w, old_w, m * sizeof(float));
+    memcpy(new_cg, old_cg, (m+1) * sizeof(float));
+    if (size > 1) store.Free(size, slot_);
+    size = n; slot_ = new_slot;
   }
 
-  inline float& w_0() { return size == 1 ? *(float *)&w : w[0]; }
-  inline float w_0() const { return size == 1 ? *(float *)&w : w[0]; }
-
-  inline float& sqc_grad_0() {
-    return size == 1 ? *(float *)&sqc_grad : sqc_grad[0];
+  /// \brief w and V
+  inline float* w() { return size == 1 ? &w0_ : store.Get(size, slot_); }
+  inline const float* w() const {
+    return size == 1 ? &w0_ : store.Get(size, slot_);
   }
 
-  inline float& z_0() {
-    return size == 1 ? *(((float *)&sqc_grad)+1) : sqc_grad[1];
+  /// \brief square root of the cumulative gradient, with z_0 at position 1
+  inline float* sqc_grad() {
+    return size == 1 ? cg0_ : store.Get(size, slot_) + size;
   }
 
+  inline float& w_0() { return w()[0]; }
+  inline float w_0() const { return w()[0]; }
+  inline float& sqc_grad_0() { return sqc_grad()[0]; }
+  inline float& z_0() { return sqc_grad()[1]; }
+
+  /// the on-disk format is the same as the one storing w and sqc_grad in
+  /// pointer-sized fields when size == 1
   void Load(Stream* fi) {
-    fi->Read(&size, sizeof(size)) ;
-    if (size == 1) {
-      fi->Read(&w, sizeof(float*));
-      fi->Read(&sqc_grad, sizeof(float*));
+    Clear();
+    int n = 1;
+    fi->Read(&n, sizeof(n));
+    if (n == 1) {
+      float buf[4];
+      fi->Read(buf, sizeof(buf));
+      w0_ = buf[0]; cg0_[0] = buf[2]; cg0_[1] = buf[3];
     } else {
-      w = new float[size];
-      sqc_grad = new float[size+1];
-      fi->Read(w, sizeof(float)*size);
-      fi->Read(sqc_grad, sizeof(float)*(size+1));
+      Resize(n);
+      fi->Read(w(), sizeof(float)*(2*size+1));
       ISGDHandle::new_V += size - 1;
     }
     if (w_0() != 0) ++ ISGDHandle::new_w;
@@ -184,11 +259,10 @@ struct AdaGradEntry {
   void Save(Stream *fo) const {
     fo->Write(&size, sizeof(size));
     if (size == 1) {
-      fo->Write(&w, sizeof(float*));
-      fo->Write(&sqc_grad, sizeof(float*));
+      float buf[4] = {w0_, 0, cg0_[0], cg0_[1]};
+      fo->Write(buf, sizeof(buf));
     } else {
-      fo->Write(w, sizeof(float)*size);
-      fo->Write(sqc_grad, sizeof(float)*(size+1));
+      fo->Write(w(), sizeof(float)*(2*size+1));
     }
   }
 
@@ -197,15 +271,17 @@ struct AdaGradEntry {
   /// #appearence of this feature in the data
   unsigned fea_cnt = 0;
 
-  /// length of w. if size == 1, then using w itself to store the value to save
-  /// memory and avoid unnecessary new (see w_0())
+  /// length of w. if size == 1, then w_0, sqc_grad_0 and z_0 are stored
+  /// inline to save memory. otherwise they are stored in slot_ of \ref store
   int size = 1;
 
-  /// w and V
-  float *w = NULL;
+  /// \brief the arena shared by all entries
+  static EmbeddingStore store;
 
-  /// square root of the cumulative gradient
-  float *sqc_grad = NULL;
+ private:
+  uint32_t slot_ = 0;
+  float w0_ = 0;
+  float cg0_[2] = {0, 0};
 };
 
 /**
@@ -226,7 +302,7 @@ struct AdaGradHandle : public ISGDHandle {
 
       // update V
       if (recv.size > 1) {
-        UpdateV(val.w+1, val.sqc_grad+2, recv.data+1, recv.size-1);
+        UpdateV(val.w()+1, val.sqc_grad()+2, recv.data+1, recv.size-1);
       }
     }
   }
@@ -238,7 +314,7 @@ struct AdaGradHandle : public ISGDHandle {
       send[0] = w0;
       send.size = 1;
     } else {
-      send.data = val.w;
+      send.data = const_cast<float*>(val.w());
       send.size = val.size;
     }
   }
@@ -250,9 +326,10 @@ struct AdaGradHandle : public ISGDHandle {
         (!l1_shrk || val.w_0() != 0)) {
       int old_siz = val.size;
       val.Resize(V.dim + 1);
+      float* w = val.w(); float* cg = val.sqc_grad();
       for (int j = old_siz; j < val.size; ++j) {
-        val.w[j] = rand() / (float) RAND_MAX * (V.V_max - V.V_min) + V.V_min;
-        val.sqc_grad[j+1] = 0;
+        w[j] = rand() / (float) RAND_MAX * (V.V_max - V.V_min) + V.V_min;
+        cg[j+1] = 0;
       }
       new_V += val.size - old_siz;
     }
@@ -322,22 +399,31 @@ class AsyncServer : public solver::MinibatchServer {
       h.V.beta      = c.has_lr_beta() ? c.lr_beta() : h.beta;
     }
 
-    Server s(h);
+    // process a push or pull request with num_threads threads
+    Server s(h, 1, conf.num_threads());
     server_ = s.server();
   }
 
   virtual ~AsyncServer() { }
  protected:
-  virtual void LoadModel(Stream* fi) {
-    server_->Load(fi);
+  virtual void LoadModel(Stream* fi, const std::string& filename) {
+    if (conf_.shard_model()) {
+      server_->LoadSharded(fi, filename);
+    } else {
+      server_->Load(fi);
+    }
 
     Progress prog;
     prog.new_w() = ISGDHandle::new_w; prog.new_V() = ISGDHandle::new_V;
     ReportToScheduler(prog.data);
   }
 
-  virtual void SaveModel(Stream* fo) const {
-    server_->Save(fo);
+  virtual void SaveModel(Stream* fo, const std::string& filename) const {
+    if (conf_.shard_model()) {
+      server_->SaveSharded(fo, filename);
+    } else {
+      server_->Save(fo);
+    }
   }
   ps::KVStore* server_;
   Config conf_;
@@ -350,6 +436,14 @@ class AsyncWorker : public solver::MinibatchWorker {
     shuffle_       = conf_.rand_shuffle();
     concurrent_mb_ = conf_.max_concurrency();
     neg_sampling_  = conf_.neg_sampling();
+    data_cache_    = conf_.data_cache();
+    localized_cache_ = conf_.localized_cache();
+    parse_threads_ = conf_.parse_threads();
+    localize_threads_ = conf_.localize_threads();
+    compute_threads_ = conf_.compute_threads();
+    predict_out_   = conf_.predict_out();
+    predict_binary_ = conf_.predict_binary();
+    fastmath::UseLibm() = conf_.exact_math();
     for (int i = 0; i < conf.embedding_size(); ++i) {
       if (conf.embedding(i).dim() > 0) {
         do_embedding_ = true; break;
@@ -360,73 +454,89 @@ class AsyncWorker : public solver::MinibatchWorker {
 
  protected:
 
-  virtual void ProcessMinibatch(const Minibatch& mb, const Workload& wl) {
-    auto data = new dmlc::data::RowBlockContainer<unsigned>();
-    auto feaid = std::make_shared<std::vector<FeaID>>();
-    auto feacnt = std::make_shared<std::vector<float>>();
+  virtual MinibatchBuffer* LocalizeMinibatch(
+      const Minibatch& mb, size_t id, const Workload& wl) {
+    // check out the buffers, they are given back when the minibatch is done
+    MinibatchContext* ctx = ctx_pool_.Get();
+    ctx->Reset();
+    if (!ctx->lc) ctx->lc.reset(new Localizer<FeaID>(conf_.num_threads()));
+
+    // the feature count is only available by localizing
+    if (PushCount(wl) || !GetLocalized(id, &ctx->data, ctx->feaid.get())) {
+      ctx->lc->Localize(mb, &ctx->data, ctx->feaid.get(), ctx->feacnt.get());
+      PutLocalized(id, ctx->data, *ctx->feaid);
+    }
+    return ctx;
+  }
 
-    double start = GetTime();
-    Localizer<FeaID> lc(conf_.num_threads());
-    lc.Localize(mb, data, feaid.get(), feacnt.get());
-    workload_time_ += GetTime() - start;
+  virtual void ProcessMinibatch(MinibatchBuffer* buf, const Workload& wl) {
+    auto ctx = static_cast<MinibatchContext*>(buf);
 
     ps::SyncOpts pull_w_opt;
-    if (wl.type == Workload::TRAIN && wl.data_pass == 0 && do_embedding_) {
+    if (PushCount(wl)) {
       // push the feature count to the servers
       ps::SyncOpts cnt_opt;
       SetFilters(0, &cnt_opt);
       cnt_opt.cmd = kPushFeaCnt;
-      int t = server_.ZPush(feaid, feacnt, cnt_opt);
+      int t = server_.ZPush(ctx->feaid, ctx->feacnt, cnt_opt);
       pull_w_opt.deps.push_back(t);
       // LL << DebugStr(*feacnt);
     }
 
-    // pull the weight from the servers
-    auto val = new std::vector<float>();
-    auto val_siz = new std::vector<int>();
+    // opened on this thread, the compute threads write into it in the order of
+    // the minibatches
+    PredictionWriter* pred = wl.type == Workload::PRED ?
+        PredictWriter(predict_out_, predict_binary_, wl) : NULL;
 
     // this callback will be called when the weight has been actually pulled
-    // back
-    pull_w_opt.callback = [this, data, feaid, val, val_siz, wl]() {
-      double start = GetTime();
-      // eval the objective, and report progress to the scheduler
-      Loss<float> loss(data->GetBlock(), *val, *val_siz, conf_);
-      Progress prog; loss.Evaluate(&prog); ReportToScheduler(prog.data);
-      if (wl.type == Workload::PRED) {
-        loss.Predict(PredictStream(conf_.predict_out(), wl), conf_.prob_predict());
-      }
+    // back. it hands the computation to Compute to free the executor thread
+    pull_w_opt.callback = [this, ctx, wl, pred]() {
+      Compute([this, ctx, wl, pred]() {
+        double start = GetTime();
+        // eval the objective, and report progress to the scheduler
+        auto& loss = ctx->loss;
+        loss.Init(ctx->data.GetBlock(), *ctx->val, *ctx->val_siz, conf_);
+        Progress prog; loss.Evaluate(&prog); ReportToScheduler(prog.data);
+        if (wl.type == Workload::PRED) {
+          loss.Predict(pred, ctx->id, conf_.prob_predict());
+        }
         bool train = wl.type == Workload::TRAIN;
         if (train) {
-        // calculate and push the gradients
-        loss.CalcGrad(val);
-
-        ps::SyncOpts push_grad_opt;
-        // filters to reduce network traffic
-        SetFilters(2, &push_grad_opt);
-        // this callback will be called when the gradients have been actually
-        // pushed
-        // LL << DebugStr(*val);
-        push_grad_opt.callback = [this]() { FinishMinibatch(); };
-        server_.ZVPush(feaid,
-                       std::shared_ptr<std::vector<float>>(val),
-                       std::shared_ptr<std::vector<int>>(val_siz),
-                       push_grad_opt);
-
-      } else {
-        FinishMinibatch();
-        delete val;
-        delete val_siz;
-      }
-      delete data;
-      workload_time_ += GetTime() - start;
+          // calculate and push the gradients
+          loss.CalcGrad(ctx->val.get());
+
+          ps::SyncOpts push_grad_opt;
+          // filters to reduce network traffic
+          SetFilters(2, &push_grad_opt);
+          // this callback will be called when the gradients have been actually
+          // pushed
+          // LL << DebugStr(*val);
+          push_grad_opt.callback = [this, ctx]() {
+            ctx_pool_.Put(ctx);
+            FinishMinibatch();
+          };
+          server_.ZVPush(ctx->feaid, ctx->val, ctx->val_siz, push_grad_opt);
+          ComputeTime(GetTime() - start);
+        } else {
+          ComputeTime(GetTime() - start);
+          ctx_pool_.Put(ctx);
+          FinishMinibatch();
+        }
+      });
     };
 
+    // pull the weight from the servers
     // filters to reduce network traffic
     SetFilters(1, &pull_w_opt);
-    server_.ZVPull(feaid, val, val_siz, pull_w_opt);
+    server_.ZVPull(ctx->feaid, ctx->val.get(), ctx->val_siz.get(), pull_w_opt);
   }
 
  private:
+  // push the feature count in the first training pass
+  bool PushCount(const Workload& wl) {
+    return wl.type == Workload::TRAIN && wl.data_pass == 0 && do_embedding_;
+  }
+
   // flag: 0 push feature count, 1 pull weight, 2 push gradient
   void SetFilters(int flag, ps::SyncOpts* opts) {
     if (conf_.key_cache()) {
@@ -450,6 +560,31 @@ class AsyncWorker : public solver::MinibatchWorker {
   Config conf_;
   bool do_embedding_ = false;
   ps::KVWorker<float> server_;
+
+  /// \brief the buffers of a minibatch in flight
+  struct MinibatchContext : public MinibatchBuffer {
+    /// \brief empties the buffers, keeping their capacity
+    void Reset() {
+      data.Clear();
+      RecycleShared(&feaid);
+      RecycleShared(&feacnt);
+      RecycleShared(&val);
+      RecycleShared(&val_siz);
+    }
+    dmlc::data::RowBlockContainer<unsigned> data;
+    std::shared_ptr<std::vector<FeaID>> feaid;
+    std::shared_ptr<std::vector<float>> feacnt, val;
+    std::shared_ptr<std::vector<int>> val_siz;
+    Loss<float> loss;
+    // kept with the context to reuse its buffers
+    std::unique_ptr<Localizer<FeaID>> lc;
+  };
+  // a context is checked out from LocalizeMinibatch until the minibatch is
+  // done. the pool does not cap them, it grows to the most minibatches
+  // between the two: the ones in flight (max_concurrency, or
+  // val_concurrent_mb_ when validating) plus the ones being localized or
+  // queued for the pull, about 2 * localize_threads more
+  ObjectPool<MinibatchContext> ctx_pool_;
 };
 
 
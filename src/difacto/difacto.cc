@@ -9,6 +9,10 @@ App* App::Create(int argc, char *argv[]) {
   if (strcmp(argv[1], "none")) parser.ReadFile(argv[1]);
   parser.ReadArgs(argc-2, argv+2);
   ::dmlc::difacto::Config conf; parser.ParseToProto(&conf);
+  for (int i = 0; i < conf.embedding_size(); ++i) {
+    CHECK_LE(conf.embedding(i).dim(), ::dmlc::difacto::EmbeddingStore::kMaxDim)
+        << "embedding dim is too large";
+  }
 
   NodeInfo n;
   if (n.IsWorker()) {
@@ -24,8 +28,9 @@ App* App::Create(int argc, char *argv[]) {
 }
 }  // namespace ps
 
-int64_t dmlc::difacto::ISGDHandle::new_w = 0;
-int64_t dmlc::difacto::ISGDHandle::new_V = 0;
+std::atomic<int64_t> dmlc::difacto::ISGDHandle::new_w(0);
+std::atomic<int64_t> dmlc::difacto::ISGDHandle::new_V(0);
+dmlc::difacto::EmbeddingStore dmlc::difacto::AdaGradEntry::store;
 
 int main(int argc, char *argv[]) {
   return ps::RunSystem(&argc, &argv);
@@ -1,8 +1,13 @@
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <unordered_map>
+#include <vector>
 #include "dmlc/io.h"
 #include "dmlc/logging.h"
+#include "kv/kv_store_io.h"
+#include "base/flat_model.h"
+#include "base/match_file.h"
 
 using namespace std;
 using namespace dmlc;
@@ -12,7 +17,9 @@ class Dump {
  
  public:
 
-  Dump(string file_in, string file_out) : file_in_(file_in),file_out_(file_out) {}
+  Dump(string file_in, string file_out, string flat_out, bool shard_model)
+      : file_in_(file_in),file_out_(file_out),flat_out_(flat_out),
+        shard_model_(shard_model) {}
   ~Dump() {data_.clear();}
 
   // value type stored on sever nodes, can be also other Entrys
@@ -55,13 +62,60 @@ class Dump {
     bool Empty() const { return (w_0() == 0 && size == 1); }
   };
 
-  void LoadModel(const std::string filename) {
-    Stream* fi = CHECK_NOTNULL(Stream::Create(filename.c_str(), "r"));
-    K key;
-    while (true) {
-      if (fi->Read(&key, sizeof(K)) != sizeof(K)) break;
-      data_[key].Load(fi);
+  // the model files matched by file_in_, such as model_part-.* for the files
+  // saved by all servers. the shards of a sharded model are not matched, they
+  // are read through their model file
+  std::vector<std::string> ModelFiles() {
+    std::string pattern = file_in_;
+    if (pattern.empty() || pattern.back() != '$') pattern += '$';
+    std::vector<std::string> files, matched;
+    MatchFile(pattern, &matched);
+    regex_t shard;
+    CHECK_EQ(regcomp(&shard, "_shard-[0-9]+$", REG_EXTENDED | REG_NOSUB), 0);
+    for (const auto& f : matched) {
+      if (regexec(&shard, f.c_str(), 0, NULL, 0)) files.push_back(f);
     }
+    regfree(&shard);
+    CHECK(files.size()) << "no model file matches " << file_in_;
+    std::sort(files.begin(), files.end());
+    return files;
+  }
+
+  // calls read with each stream of the records of the model files: the files
+  // themselves, or their shards <file>_shard-i if saved with shard_model
+  template <typename Read>
+  void ReadModel(Read read) {
+    for (const auto& filename : ModelFiles()) {
+      cout << "reading " << filename << "\n";
+      Stream* fi = CHECK_NOTNULL(Stream::Create(filename.c_str(), "r"));
+      if (!shard_model_) {
+        ps::BufferedReader in(fi);
+        read(&in);
+        delete fi;
+        continue;
+      }
+      int n = ps::ReadNumShards(fi);
+      delete fi;
+      for (int i = 0; i < n; ++i) {
+        string shard = ps::ShardName(filename, i);
+        fi = CHECK_NOTNULL(Stream::Create(shard.c_str(), "r"));
+        uint64_t cnt;
+        CHECK_EQ(fi->Read(&cnt, sizeof(cnt)), sizeof(cnt)) << "bad shard " << shard;
+        ps::BufferedReader in(fi);
+        read(&in);
+        delete fi;
+      }
+    }
+  }
+
+  void LoadModel() {
+    ReadModel([this](Stream* fi) {
+        K key;
+        while (true) {
+          if (fi->Read(&key, sizeof(K)) != sizeof(K)) break;
+          data_[key].Load(fi);
+        }
+      });
     cout << "loaded " << data_.size() << " kv pairs\n";
   }
 
@@ -87,8 +141,36 @@ class Dump {
     cout << "dumped " << dumped << " kv pairs\n";
   }
 
+  // export w and V of the non-empty entries of all model files into one flat
+  // model for serving. the records are read one by one instead of into data_,
+  // and sqc_grad is skipped
+  void ExportModel(const std::string filename) {
+    Stream* fo = CHECK_NOTNULL(Stream::Create(filename.c_str(), "w"));
+    FlatModelWriter writer(fo);
+    ReadModel([&writer](Stream* in) {
+        K key;
+        int size;
+        std::vector<float> buf;
+        while (in->Read(&key, sizeof(K)) == sizeof(K)) {
+          CHECK_EQ(in->Read(&size, sizeof(size)), sizeof(size));
+          // size == 1 has w, 0, sqc_grad, z, others have w, V and size+1
+          // sqc_grad
+          buf.resize(size == 1 ? 4 : 2 * size + 1);
+          CHECK_EQ(in->Read(buf.data(), buf.size() * sizeof(float)),
+                   buf.size() * sizeof(float));
+          if (size == 1 && buf[0] == 0) continue;
+          writer.Add(key, buf.data(), size);
+        }
+      });
+    writer.Close();
+    cout << "exported " << writer.size() << " kv pairs\n";
+    delete fo;
+  }
+
   void run() {
-    LoadModel(file_in_);
+    if (!flat_out_.empty()) ExportModel(flat_out_);
+    if (file_out_.empty()) return;
+    LoadModel();
     DumpModel(file_out_);
   }
 
@@ -96,23 +178,29 @@ class Dump {
   unordered_map<K, AdaGradEntry> data_;
   string file_in_;
   string file_out_;
+  string flat_out_;
+  bool shard_model_;
 };
 
 int main(int argc, char *argv[]) {
   if (argc < 3) {
-    cout << "Usage: <model_in> <dump_out>\n";
+    cout << "Usage: model_in=<model_in regex> [dump_out=<dump_out>]"
+         << " [flat_out=<flat_out>] [shard_model=0]\n";
     return 0;
   }
   google::InitGoogleLogging(argv[0]);
-  string model_in, dump_out;
+  string model_in, dump_out, flat_out;
+  bool shard_model = false;
   for (int i = 1; i < argc; ++i) {
     char name[256], val[256];
     if (sscanf(argv[i], "%[^=]=%s", name, val) == 2) {
       if (!strcmp(name, "model_in")) model_in = val;
       if (!strcmp(name, "dump_out")) dump_out = val;
+      if (!strcmp(name, "flat_out")) flat_out = val;
+      if (!strcmp(name, "shard_model")) shard_model = atoi(val);
     }
   }
-  Dump d(model_in, dump_out);
+  Dump d(model_in, dump_out, flat_out, shard_model);
   d.run();
   return 0;
 }
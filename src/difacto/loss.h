@@ -1,6 +1,10 @@
 #pragma once
-#include "base/spmm.h"
+#include <type_traits>
+#include "base/spmv.h"
+#include "base/spmm_simd.h"
+#include "base/fast_math.h"
 #include "base/binary_class_evaluation.h"
+#include "base/prediction_writer.h"
 #include "config.pb.h"
 #include "dmlc/data.h"
 #include "dmlc/io.h"
@@ -13,6 +17,8 @@ namespace difacto {
 template <typename T>
 class Loss {
  public:
+  Loss() { }
+
   /**
    * create and init the loss function
    *
@@ -25,12 +31,27 @@ class Loss {
        const std::vector<T>& model,
        const std::vector<int>& model_siz,
        const Config& conf) {
+    Init(data, model, model_siz, conf);
+  }
+
+  /**
+   * \brief init the loss function for a new minibatch, the buffers of the
+   * previous one are reused. The arguments are the same as the constructor's
+   */
+  void Init(const RowBlock<unsigned>& data,
+            const std::vector<T>& model,
+            const std::vector<int>& model_siz,
+            const Config& conf) {
     nt_ = conf.num_threads();
+    py_.clear();
 
     // init w
+    w.Clear();
     w.Load(0, data, model, model_siz);
+    rows_.Init(data, nt_);
 
     // init V
+    V.Clear();
     if (conf.embedding_size() == 0) return;
     const auto& cf = conf.embedding(0);
     if (cf.dim() == 0) return;
@@ -51,43 +72,29 @@ class Loss {
    * .* : elemenetal-wise times
    */
   void Evaluate(Progress* prog) {
-
-    // py = X * w
     py_.resize(w.X.size);
-    SpMV::Times(w.X, w.weight, &py_, nt_);
-
     BinClassEval<T> eval(w.X.label, py_.data(), py_.size(), nt_);
-    prog->objv_w() = eval.LogitObjv();
 
-    // py += .5 * sum((X*V).^2 - (X.*X)*(V.*V), 2);
     if (!V.weight.empty()) {
-      // tmp = (X.*X)*(V.*V)
-      std::vector<T> vv = V.weight;
-      for (auto& v : vv) v *= v;
-      CHECK_EQ(vv.size(), V.pos.size() * V.dim);
-      std::vector<T> xxvv(V.X.size * V.dim);
-      SpMM::Times(V.XX, vv, &xxvv, nt_);
-
-      // V.XV = X*V
-      V.XV.resize(xxvv.size());
-      SpMM::Times(V.X, V.weight, &V.XV, nt_);
-
-      // py += .5 * sum((V.XV).^2 - xxvv)
-#pragma omp parallel for num_threads(nt_)
-      for (size_t i = 0; i < py_.size(); ++i) {
-        T* t = V.XV.data() + i * V.dim;
-        T* tt = xxvv.data() + i * V.dim;
-        T s = 0;
-        for (int j = 0; j < V.dim; ++j) s += t[j] * t[j] - tt[j];
-        py_[i] += .5 * s;
-      }
+      // py_w = X * w, py = py_w + .5 * sum((X*V).^2 - (X.*X)*(V.*V), 2), and
+      // V.XV = X*V in a single pass
+      auto& py_w = py_w_;
+      py_w.resize(py_.size());
+      CHECK_EQ(V.weight.size(), V.pos.size() * V.dim);
+      V.XV.resize(V.X.size * V.dim);
+      FusedEvaluate(py_w.data());
+      prog->objv_w() = BinClassEval<T>(
+          w.X.label, py_w.data(), py_w.size(), nt_).LogitObjv();
       prog->objv() = eval.LogitObjv();
     } else {
+      // py = X * w
+      SpMV::Times(w.X, w.weight, &py_, nt_, &rows_);
+      prog->objv_w() = eval.LogitObjv();
       prog->objv() = prog->objv_w();
     }
 
     // auc, acc, logloss, copc
-    prog->auc()    = eval.AUC();
+    eval.AddToAUCHistogram(prog->auc_pos(), prog->auc_neg());
     prog->new_ex() = w.X.size;
     prog->count()  = 1;
     // prog->copc()   = eval.Copc();
@@ -95,7 +102,7 @@ class Loss {
 
   /*!
    * \brief compute the gradients
-   * p = - y ./ (1 + exp (y .* py));
+   * p = - y ./ (1 + exp (y .* py)) = - y .* sigmoid(- y .* py);
    * grad_w = X' * p;
    * grad_u = X' * diag(p) * X * V  - diag((X.*X)'*p) * V
    */
@@ -105,41 +112,30 @@ class Loss {
 #pragma omp parallel for num_threads(nt_)
     for (size_t i = 0; i < py_.size(); ++i) {
       T y = w.X.label[i] > 0 ? 1 : -1;
-      py_[i] = - y / ( 1 + exp ( y * py_[i] ));
+      py_[i] = - y * py_[i];
+    }
+    fastmath::Sigmoid(py_.data(), py_.data(), py_.size(), nt_);
+#pragma omp parallel for num_threads(nt_)
+    for (size_t i = 0; i < py_.size(); ++i) {
+      T y = w.X.label[i] > 0 ? 1 : -1;
+      py_[i] *= - y;
     }
 
+    // the columns of X, shared by grad_w and grad_u
+    if (!w.weight.empty()) cols_.Init(w.X, w.weight.size(), nt_, &rows_);
+
     // grad_w = ...
-    SpMV::TransTimes(w.X, py_, &w.weight, nt_);
+    SpMV::TransTimes(w.X, py_, &w.weight, nt_,
+                     w.weight.empty() ? NULL : &cols_);
     w.Save(grad);
 
     // grad_u = ...
     if (!V.weight.empty()) {
-      int dim = V.dim;
-
-      // xxp = (X.*X)'*p
-      size_t m = V.pos.size();
-      std::vector<T> xxp(m);
-      SpMM::TransTimes(V.XX, py_, &xxp, nt_);
-
-      // V = - diag(xxp) * V
-      CHECK_EQ(V.weight.size(), dim * m);
-#pragma omp parallel for num_threads(nt_)
-      for (size_t i = 0; i < m; ++i) {
-        T* v = V.weight.data() + i * dim;
-        for (int j = 0; j < dim; ++j) v[j] *= - xxp[i];
-      }
-
-      // V.XV = diag(p) * X * V
-      size_t n = py_.size();
-      CHECK_EQ(V.XV.size(), n * dim);
-#pragma omp parallel for num_threads(nt_)
-      for (size_t i = 0; i < n; ++i) {
-        T* y = V.XV.data() + i * dim;
-        for (int j = 0; j < dim; ++j) y[j] *= py_[i];
-      }
-
-      // V += X' * V.XV
-      SpMM::TransTimes(V.X, V.XV, (T)1, V.weight, &V.weight, nt_);
+      CHECK_EQ(V.XV.size(), py_.size() * V.dim);
+      auto& grad_V = grad_V_;
+      grad_V.assign(V.weight.size(), 0);
+      FusedGrad(grad_V.data());
+      V.weight.swap(grad_V);
 
       // some preprocessing
       if (V.grad_clipping > 0) {
@@ -165,20 +161,133 @@ class Loss {
     for (T& g : grad) g = g / norm;
   }
 
-  virtual void Predict(Stream* fo, bool prob_out) {
+  /**
+   * \brief writes the predictions of this minibatch
+   * \param id the position of the minibatch in the workload
+   * \param prob_out output probability
+   */
+  virtual void Predict(PredictionWriter* out, size_t id, bool prob_out) {
     if (py_.empty()) {
       py_.resize(w.X.size);
-      SpMV::Times(w.X, w.weight, &py_, nt_);
+      SpMV::Times(w.X, w.weight, &py_, nt_, &rows_);
     }
-    ostream os(fo);
     if (prob_out) {
-      for (auto p : py_) os << 1.0 / (1.0 + exp( - p )) << "\n";
+      std::vector<T> prob(py_.size());
+      fastmath::Sigmoid(py_.data(), prob.data(), prob.size(), nt_);
+      out->Write(id, prob.data(), prob.size(), nt_);
     } else {
-      for (auto p : py_) os << p << "\n";
+      out->Write(id, py_.data(), py_.size(), nt_);
     }
   }
 
  private:
+  /// \brief the SIMD kernels for V.dim, NULL if T is not float or V.dim is not
+  /// specialized in spmm_simd.h
+  const spmm::Kernels* SimdKernels() const {
+    return std::is_same<T, float>::value ? spmm::GetKernels(V.dim) : NULL;
+  }
+
+  /**
+   * \brief the forward pass of each row i in a single sweep:
+   *
+   * py_w[i] = X_i * w, V.XV_i = X_i * V,
+   * py_[i] = py_w[i] + .5 * (|V.XV_i|^2 - sum_j X_ij^2 |V_j|^2)
+   *
+   * where V.XV_i is the only dim-length accumulator, and V_j is the row
+   * V.col_map[j] of V.weight. It runs spmm::EvaluateKernel if there is one for
+   * V.dim
+   */
+  void FusedEvaluate(T* py_w) {
+    const int dim = V.dim;
+    const auto& X = w.X;
+    const unsigned* col_map = V.col_map.data();
+    const spmm::Kernels* simd = SimdKernels();
+#pragma omp parallel for num_threads(nt_) schedule(static, 1)
+    for (size_t r = 0; r < rows_.size(); ++r) {
+      if (simd) {
+        simd->evaluate(X.offset, X.index, X.value, rows_[r].begin,
+                       rows_[r].end, (const float*)w.weight.data(), col_map,
+                       (const float*)V.weight.data(), (float*)V.XV.data(),
+                       (float*)py_w, (float*)py_.data());
+        continue;
+      }
+      for (size_t i = rows_[r].begin; i < rows_[r].end; ++i) {
+        T lin = 0;
+        T* xv = V.XV.data() + i * dim;
+        for (int k = 0; k < dim; ++k) xv[k] = 0;
+        T xxvv = 0;
+        for (size_t j = X.offset[i]; j < X.offset[i+1]; ++j) {
+          T x = X.value ? X.value[j] : 1;
+          unsigned c = X.index[j];
+          lin += x * w.weight[c];
+          unsigned e = col_map[c];
+          if (e == kNoEmbedding) continue;
+          const T* v = V.weight.data() + (size_t)e * dim;
+          T vv = 0;
+          for (int k = 0; k < dim; ++k) {
+            xv[k] += x * v[k];
+            vv += v[k] * v[k];
+          }
+          xxvv += x * x * vv;
+        }
+        T s = 0;
+        for (int k = 0; k < dim; ++k) s += xv[k] * xv[k];
+        py_w[i] = lin;
+        py_[i] = lin + .5 * (s - xxvv);
+      }
+    }
+  }
+
+  /**
+   * \brief the gradient of V in a single sweep, given p = py_ and V.XV from
+   * \ref FusedEvaluate
+   *
+   * grad_j = sum_i p_i X_ij V.XV_i - (sum_i p_i X_ij^2) V_j
+   *
+   * it walks the columns of X in cols_, so each thread visits only the
+   * nonzeros of its own columns. It runs spmm::GradKernel if there is one for
+   * V.dim
+   */
+  void FusedGrad(T* grad) {
+    const int dim = V.dim;
+    // V.X is w.X, whose transpose is cols_
+    const auto& XT = cols_.mat();
+    const auto& seg = cols_.segments();
+    const unsigned* col_map = V.col_map.data();
+    const spmm::Kernels* simd = SimdKernels();
+#pragma omp parallel for num_threads(nt_) schedule(static, 1)
+    for (size_t s = 0; s < seg.size(); ++s) {
+      if (simd) {
+        simd->grad(XT.offset, XT.index, XT.value, seg[s].begin, seg[s].end,
+                   col_map, (const float*)py_.data(),
+                   (const float*)V.XV.data(), (const float*)V.weight.data(),
+                   (float*)grad);
+        continue;
+      }
+      for (size_t c = seg[s].begin; c < seg[s].end; ++c) {
+        unsigned e = col_map[c];
+        if (e == kNoEmbedding) continue;
+        T* g = grad + (size_t)e * dim;
+        T b = 0;
+        for (size_t j = XT.offset[c]; j < XT.offset[c+1]; ++j) {
+          unsigned i = XT.index[j];
+          T p = py_[i];
+          if (p == 0) continue;
+          T x = XT.value ? XT.value[j] : 1;
+          T a = p * x;
+          b += a * x;
+          const T* xv = V.XV.data() + i * dim;
+          for (int k = 0; k < dim; ++k) g[k] += a * xv[k];
+        }
+        const T* v = V.weight.data() + (size_t)e * dim;
+        for (int k = 0; k < dim; ++k) g[k] -= b * v[k];
+      }
+    }
+  }
+
+  /// \brief the column has no embedding in Data::col_map
+  static const unsigned kNoEmbedding = spmm::kNoEmbedding;
+
   /// \brief store data and model w (dim==0) and V (dim >= 1)
   struct Data {
     /// \brief get data and model
@@ -186,11 +295,10 @@ class Loss {
               const std::vector<T>& model,
               const std::vector<int>& model_siz) {
       // init pos and w
-      std::vector<unsigned> col_map;
       dim = d;
       if (dim == 0) {  // w
         pos.resize(model_siz.size());
-        weight.resize(model_siz.size());
+        weight.assign(model_siz.size(), 0);
         unsigned p = 0;
         for (size_t i = 0; i < model_siz.size(); ++i) {
           if (model_siz[i] == 0) {
@@ -201,12 +309,12 @@ class Loss {
         }
         CHECK_EQ((size_t)p, model.size());
       } else {  // V
-        col_map.resize(model_siz.size());
-        unsigned k = 0, p = 0;
+        col_map.resize(model_siz.size(), (unsigned)kNoEmbedding);
+        unsigned p = 0;
         for (size_t i = 0; i < model_siz.size(); ++i) {
           if (model_siz[i] == dim + 1) {
+            col_map[i] = pos.size();
             pos.push_back(p+1);  // skip the first dim
-            col_map[i] = ++ k;
           }
           p += model_siz[i];
         }
@@ -216,40 +324,15 @@ class Loss {
           memcpy(weight.data()+i*dim, model.data()+pos[i], dim*sizeof(T));
         }
       }
-      if (weight.empty()) return;
-
-      // init X
-      if (dim == 0) {  // w
-        X = data;
-      } else {  // V
-        // pick the columns with model_siz = dim + 1
-        os.push_back(0);
-        for (size_t i = 0; i < data.size; ++i) {
-          for (size_t j = data.offset[i]; j < data.offset[i+1]; ++j) {
-            unsigned d = data.index[j];
-            unsigned k = col_map[d];
-            if (k > 0) {
-              idx.push_back(k-1);
-              if (data.value) val_.push_back(data.value[j]);
-            }
-          }
-          os.push_back(idx.size());
-        }
-        X.size = data.size;
-        X.offset = BeginPtr(os);
-        X.value = BeginPtr(val_);
-        X.index = BeginPtr(idx);
-      }
+      // both w and V use the data directly, even if no column has a weight,
+      // since the rows and labels of X are still evaluated. V skips the columns
+      // without embedding through col_map
+      X = data;
+    }
 
-      // init XX
-      XX = X;
-      if (X.value) {
-        val2_.resize(X.offset[X.size]);
-        for (size_t i = 0; i < val2_.size(); ++i) {
-          val2_[i] = X.value[i] * X.value[i];
-        }
-        XX.value = BeginPtr(val2_);
-      }
+    /// \brief empties the model, keeping the capacity
+    void Clear() {
+      weight.clear(); pos.clear(); col_map.clear();
     }
 
     /// \brief set the gradient
@@ -264,22 +347,26 @@ class Loss {
     }
 
     int dim;
-    RowBlock<unsigned> X, XX;  // XX = X.*X
+    RowBlock<unsigned> X;
     std::vector<T> weight;
     std::vector<unsigned> pos;
+    /// \brief V only, the row in weight of a column, or kNoEmbedding
+    std::vector<unsigned> col_map;
 
     std::vector<T> XV;
     T dropout = 0;
     T grad_clipping = 0;
     T grad_normalization = 0;
-   private:
-    std::vector<T> val_, val2_;
-    std::vector<size_t> os;
-    std::vector<unsigned> idx;
   };
   Data w, V;
 
   std::vector<T> py_;
+  // the rows of the data balanced by nnz for nt_ threads
+  RowSegments rows_;
+  // the transpose of the data, built by CalcGrad
+  TransposedSpMat cols_;
+  // buffers kept for the next minibatch, V.weight and grad_V_ are swapped
+  std::vector<T> py_w_, grad_V_;
   int nt_;  // number of threads
 };
 
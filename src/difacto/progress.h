@@ -1,11 +1,21 @@
 #pragma once
 #include <vector>
 #include <string>
+#include "base/auc_histogram.h"
 namespace dmlc {
 namespace difacto {
 
+/**
+ * \brief the progress reported to the scheduler, which sums the reports. The
+ * AUC is computed from the summed histograms of the predictions.
+ *
+ * data has only the kNumStats stats until the histograms are accessed, so the
+ * reports of servers and of the workers' pushes stay small. The scheduler
+ * sums a shorter report as if padded with zeros.
+ */
 struct Progress {
-  Progress() : data(8) { }
+  static const int kNumStats = 7;
+  Progress() : data(kNumStats) { }
 
   static std::string HeadStr() {
     return "  ttl #ex   inc #ex |  |w|_0  logloss_w |   |V|_0    logloss    AUC";
@@ -13,7 +23,7 @@ struct Progress {
 
   std::string PrintStr() {
 
-    if (data.size() < 8) data.resize(8,0);
+    if (data.size() < (size_t)kNumStats) data.resize(kNumStats, 0);
     ttl_ex += new_ex();
     nnz_w += new_w();
     nnz_V += new_V();
@@ -23,22 +33,29 @@ struct Progress {
     char buf[256];
     snprintf(buf, 256, "%9.4g  %7.2g | %9.4g  %6.4lf | %9.4g  %7.5lf  %7.5lf ",
              ttl_ex, new_ex(), nnz_w, objv_w() / new_ex(), nnz_V,
-             objv() / new_ex(),  auc() / count());
+             objv() / new_ex(),  AUCHistogram::AUC(auc_pos(), auc_neg()));
     return std::string(buf);
   }
 
   double& objv() { return data[0]; }
-  double& auc() { return data[1]; }
-  double& objv_w() { return data[2]; }
-  double& copc() { return data[3]; }
+  double& objv_w() { return data[1]; }
+  double& copc() { return data[2]; }
 
-  double& count() { return data[4]; }
-  double& new_ex() { return data[5]; }
-  double& new_w() { return data[6]; }
-  double& new_V() { return data[7]; }
+  double& count() { return data[3]; }
+  double& new_ex() { return data[4]; }
+  double& new_w() { return data[5]; }
+  double& new_V() { return data[6]; }
+
+  /// \brief the histograms of the predictions of positive and negative
+  /// examples, which are appended to data at the first access
+  double* auc_pos() {
+    data.resize(kNumStats + 2 * AUCHistogram::kBuckets, 0);
+    return data.data() + kNumStats;
+  }
+  double* auc_neg() { return auc_pos() + AUCHistogram::kBuckets; }
 
   double objv() const { return data[0]; }
-  double new_ex() const { return data[5]; }
+  double new_ex() const { return data[4]; }
 
   std::vector<double> data;
   double ttl_ex = 0, nnz_w = 0, nnz_V;
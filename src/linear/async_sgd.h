@@ -6,6 +6,7 @@
 #include "config.pb.h"
 #include "progress.h"
 #include "base/localizer.h"
+#include "base/object_pool.h"
 #include "loss.h"
 #include "penalty.h"
 
@@ -228,14 +229,22 @@ class AsgdServer : public solver::MinibatchServer {
     server_ = s.server();
   }
 
-  virtual void LoadModel(Stream* fi) {
-    server_->Load(fi);
+  virtual void LoadModel(Stream* fi, const std::string& filename) {
+    if (conf_.shard_model()) {
+      server_->LoadSharded(fi, filename);
+    } else {
+      server_->Load(fi);
+    }
     Progress prog; prog.new_w() = ISGDHandle::new_w; ReportToScheduler(prog.data);
     ISGDHandle::new_w = 0;
   }
 
-  virtual void SaveModel(Stream* fo) const {
-    server_->Save(fo);
+  virtual void SaveModel(Stream* fo, const std::string& filename) const {
+    if (conf_.shard_model()) {
+      server_->SaveSharded(fo, filename);
+    } else {
+      server_->Save(fo);
+    }
   }
 
   Config conf_;
@@ -249,58 +258,81 @@ class AsgdWorker : public solver::MinibatchWorker {
     shuffle_       = conf_.rand_shuffle();
     concurrent_mb_ = conf_.max_concurrency();
     neg_sampling_  = conf_.neg_sampling();
+    data_cache_    = conf_.data_cache();
+    localized_cache_ = conf_.localized_cache();
+    parse_threads_ = conf_.parse_threads();
+    localize_threads_ = conf_.localize_threads();
+    compute_threads_ = conf_.compute_threads();
+    predict_out_   = conf_.predict_out();
+    predict_binary_ = conf_.predict_binary();
+    fastmath::UseLibm() = conf_.exact_math();
   }
   virtual ~AsgdWorker() { }
 
  protected:
-  virtual void ProcessMinibatch(const Minibatch& mb, const Workload& wl) {
+  virtual MinibatchBuffer* LocalizeMinibatch(
+      const Minibatch& mb, size_t id, const Workload& wl) {
+    // check out the buffers, they are given back when the minibatch is done
+    MinibatchContext* ctx = ctx_pool_.Get();
+    ctx->Reset();
+    if (!ctx->loss) ctx->loss.reset(CreateLoss<float>(conf_.loss()));
+    if (!ctx->lc) ctx->lc.reset(new Localizer<FeaID>(nt_));
+
     // find the unique feature ids in this minibatch
-    auto data = new dmlc::data::RowBlockContainer<unsigned>();
-    auto feaid = std::make_shared<std::vector<FeaID>>();
+    if (!GetLocalized(id, &ctx->data, ctx->feaid.get())) {
+      ctx->lc->Localize(mb, &ctx->data, ctx->feaid.get());
+      PutLocalized(id, ctx->data, *ctx->feaid);
+    }
+    return ctx;
+  }
 
-    double start = GetTime();
-    Localizer<FeaID> lc(nt_);
-    lc.Localize(mb, data, feaid.get());
-    workload_time_ += GetTime() - start;
+  virtual void ProcessMinibatch(MinibatchBuffer* buf, const Workload& wl) {
+    auto ctx = static_cast<MinibatchContext*>(buf);
 
     // pull the weight from the servers
-    auto val = new std::vector<float>();
     ps::SyncOpts pull_w_opt;
 
+    // opened on this thread, the compute threads write into it in the order of
+    // the minibatches
+    PredictionWriter* pred = wl.type == Workload::PRED ?
+        PredictWriter(predict_out_, predict_binary_, wl) : NULL;
+
     // this callback will be called when the weight has been actually pulled
-    // back
-    int k = wl.file[0].k;
-    pull_w_opt.callback = [this, data, feaid, val, k, wl]() {
-      double start = GetTime();
-      // eval the objective, and report progress to the scheduler
-      auto loss = CreateLoss<float>(conf_.loss());
-      loss->Init(data->GetBlock(), *val, nt_);
-      Progress prog; loss->Evaluate(&prog); ReportToScheduler(prog.data);
-      if (wl.type == Workload::PRED) {
-        loss->Predict(PredictStream(conf_.predict_out(), wl), conf_.prob_predict());
-      }
-      bool train = wl.type == Workload::TRAIN;
-      if (train) {
-        // calculate and push the gradients
-        loss->CalcGrad(val);
-
-        ps::SyncOpts push_grad_opt;
-        // filters to reduce network traffic
-        SetFilters(train, &push_grad_opt);
-        // this callback will be called when the gradients have been actually
-        // pushed
-        push_grad_opt.callback = [this]() { FinishMinibatch(); };
-        kv_.ZPush(
-            feaid, std::shared_ptr<std::vector<float>>(val), push_grad_opt);
-      } else {
-        FinishMinibatch();
-        delete val;
-      }
-      delete loss;
-      delete data;
-      workload_time_ += GetTime() - start;
+    // back. it hands the computation to Compute to free the executor thread
+    pull_w_opt.callback = [this, ctx, wl, pred]() {
+      Compute([this, ctx, wl, pred]() {
+        double start = GetTime();
+        // eval the objective, and report progress to the scheduler
+        auto loss = ctx->loss.get();
+        loss->Init(ctx->data.GetBlock(), *ctx->val, nt_);
+        Progress prog; loss->Evaluate(&prog); ReportToScheduler(prog.data);
+        if (wl.type == Workload::PRED) {
+          loss->Predict(pred, ctx->id, conf_.prob_predict());
+        }
+        bool train = wl.type == Workload::TRAIN;
+        if (train) {
+          // calculate and push the gradients
+          loss->CalcGrad(ctx->val.get());
+
+          ps::SyncOpts push_grad_opt;
+          // filters to reduce network traffic
+          SetFilters(train, &push_grad_opt);
+          // this callback will be called when the gradients have been actually
+          // pushed
+          push_grad_opt.callback = [this, ctx]() {
+            ctx_pool_.Put(ctx);
+            FinishMinibatch();
+          };
+          kv_.ZPush(ctx->feaid, ctx->val, push_grad_opt);
+          ComputeTime(GetTime() - start);
+        } else {
+          ComputeTime(GetTime() - start);
+          ctx_pool_.Put(ctx);
+          FinishMinibatch();
+        }
+      });
     };
-    kv_.ZPull(feaid, val, pull_w_opt);
+    kv_.ZPull(ctx->feaid, ctx->val.get(), pull_w_opt);
   }
  private:
   void SetFilters(bool push, ps::SyncOpts* opts) {
@@ -318,6 +350,28 @@ class AsgdWorker : public solver::MinibatchWorker {
   Config conf_;
   int nt_ = 2;
   ps::KVWorker<float> kv_;
+
+  /// \brief the buffers of a minibatch in flight
+  struct MinibatchContext : public MinibatchBuffer {
+    /// \brief empties the buffers, keeping their capacity
+    void Reset() {
+      data.Clear();
+      RecycleShared(&feaid);
+      RecycleShared(&val);
+    }
+    dmlc::data::RowBlockContainer<unsigned> data;
+    std::shared_ptr<std::vector<FeaID>> feaid;
+    std::shared_ptr<std::vector<float>> val;
+    std::unique_ptr<ScalarLoss<float>> loss;
+    // kept with the context to reuse its buffers
+    std::unique_ptr<Localizer<FeaID>> lc;
+  };
+  // a context is checked out from LocalizeMinibatch until the minibatch is
+  // done. the pool does not cap them, it grows to the most minibatches
+  // between the two: the ones in flight (max_concurrency, or
+  // val_concurrent_mb_ when validating) plus the ones being localized or
+  // queued for the pull, about 2 * localize_threads more
+  ObjectPool<MinibatchContext> ctx_pool_;
 };
 
 
@@ -5,7 +5,9 @@
 #include "config.pb.h"
 #include "progress.h"
 #include "base/spmv.h"
+#include "base/fast_math.h"
 #include "base/binary_class_evaluation.h"
+#include "base/prediction_writer.h"
 namespace dmlc {
 namespace linear {
 
@@ -32,9 +34,10 @@ class ScalarLoss {
   void Init(const RowBlock<unsigned>& data,
             const std::vector<V>& w, int nt) {
     data_ = data;
-    Xw_.resize(data_.size);
-    SpMV::Times(data_, w, &Xw_, nt_);
     nt_ = nt;
+    Xw_.resize(data_.size);
+    rows_.Init(data_, nt_);
+    SpMV::Times(data_, w, &Xw_, nt_, &rows_);
     init_ = true;
   }
 
@@ -50,15 +53,17 @@ class ScalarLoss {
 
   /**
    * \brief save prediction
+   * \param id the position of the minibatch in the workload
    * \param prob_out output probability
    */
-  virtual void Predict(Stream* fo, bool prob_out) {
-    CHECK(init_); CHECK_NOTNULL(fo);
-    ostream os(fo);
+  virtual void Predict(PredictionWriter* out, size_t id, bool prob_out) {
+    CHECK(init_); CHECK_NOTNULL(out);
     if (prob_out) {
-      for (auto p : Xw_) os << 1.0 / (1.0 + exp( - p )) << "\n";
+      std::vector<V> prob(Xw_.size());
+      fastmath::Sigmoid(Xw_.data(), prob.data(), prob.size(), nt_);
+      out->Write(id, prob.data(), prob.size(), nt_);
     } else {
-      for (auto p : Xw_) os << p << "\n";
+      out->Write(id, Xw_.data(), Xw_.size(), nt_);
     }
   }
 
@@ -66,6 +71,9 @@ class ScalarLoss {
   bool init_;
   RowBlock<unsigned> data_;
   std::vector<V> Xw_;  // X * w
+  RowSegments rows_;  // the rows of data_ balanced by nnz for nt_ threads
+  std::vector<V> dual_;  // reused by CalcGrad
+  std::vector<V> grad_buf_;  // the per-thread copies of grad, reused
   int nt_;
 };
 
@@ -81,7 +89,7 @@ class BinClassLoss : public ScalarLoss<V> {
   virtual void Evaluate(Progress* prog) {
     ScalarLoss<V>::Evaluate(prog);
     BinClassEval<V> eval(data_.label, Xw_.data(), Xw_.size(), nt_);
-    prog->auc()     = eval.AUC();
+    eval.AddToAUCHistogram(prog->auc_pos(), prog->auc_neg());
     prog->acc()     = eval.Accuracy(0);
   }
 };
@@ -96,6 +104,9 @@ class LogitLoss : public BinClassLoss<V> {
   using ScalarLoss<V>::Xw_;
   using ScalarLoss<V>::nt_;
   using ScalarLoss<V>::init_;
+  using ScalarLoss<V>::dual_;
+  using ScalarLoss<V>::grad_buf_;
+  using ScalarLoss<V>::rows_;
 
   virtual void Evaluate(Progress* prog) {
     BinClassLoss<V>::Evaluate(prog);
@@ -105,13 +116,21 @@ class LogitLoss : public BinClassLoss<V> {
 
   virtual void CalcGrad(std::vector<V>* grad) {
     CHECK(init_);
-    std::vector<V> dual(data_.size);
+    // dual = - y / (1 + exp(y * Xw)) = - y * sigmoid(- y * Xw)
+    auto& dual = dual_;
+    dual.resize(data_.size);
+#pragma omp parallel for num_threads(nt_)
+    for (size_t i = 0; i < data_.size; ++i) {
+      V y = data_.label[i] > 0 ? 1 : -1;
+      dual[i] = - y * Xw_[i];
+    }
+    fastmath::Sigmoid(dual.data(), dual.data(), dual.size(), nt_);
 #pragma omp parallel for num_threads(nt_)
     for (size_t i = 0; i < data_.size; ++i) {
       V y = data_.label[i] > 0 ? 1 : -1;
-      dual[i] = - y / ( 1 + exp ( y * Xw_[i] ));
+      dual[i] *= - y;
     }
-    SpMV::TransTimes(data_, dual, grad, nt_);
+    SpMV::TransTimes(data_, dual, grad, nt_, NULL, &rows_, &grad_buf_);
   }
 };
 
@@ -125,6 +144,9 @@ class SquareHingeLoss : public BinClassLoss<V> {
   using ScalarLoss<V>::Xw_;
   using ScalarLoss<V>::nt_;
   using ScalarLoss<V>::init_;
+  using ScalarLoss<V>::dual_;
+  using ScalarLoss<V>::grad_buf_;
+  using ScalarLoss<V>::rows_;
 
   virtual void Evaluate(Progress* prog) {
     BinClassLoss<V>::Evaluate(prog);
@@ -141,13 +163,14 @@ class SquareHingeLoss : public BinClassLoss<V> {
   virtual void CalcGrad(std::vector<V>* grad) {
     CHECK(init_);
 
-    std::vector<V> dual(data_.size);
+    auto& dual = dual_;
+    dual.resize(data_.size);
 #pragma omp parallel for num_threads(nt_)
     for (size_t i = 0; i < data_.size; ++i) {
       V y = data_.label[i] > 0 ? 1 : -1;
       dual[i] = y * (y * Xw_[i] > 1.0);
     }
-    SpMV::TransTimes(data_, dual, grad, nt_);
+    SpMV::TransTimes(data_, dual, grad, nt_, NULL, &rows_, &grad_buf_);
 
 #pragma omp parallel for num_threads(nt_)
     for (size_t i = 0; i < grad->size(); ++i) {
@@ -1,11 +1,21 @@
 #pragma once
 #include <vector>
 #include <string>
+#include "base/auc_histogram.h"
 namespace dmlc {
 namespace linear {
 
+/**
+ * \brief the progress reported to the scheduler, which sums the reports. The
+ * AUC is computed from the summed histograms of the predictions.
+ *
+ * data has only the kNumStats stats until the histograms are accessed, so the
+ * reports of servers and of the workers' pushes stay small. The scheduler
+ * sums a shorter report as if padded with zeros.
+ */
 struct Progress {
-  Progress() : data(6) { }
+  static const int kNumStats = 5;
+  Progress() : data(kNumStats) { }
 
   static std::string HeadStr() {
     return "  ttl #ex   inc #ex    |w|_0       logloss  accuracy     AUC";
@@ -13,7 +23,7 @@ struct Progress {
 
   std::string PrintStr() {
 
-    if (data.size() < 6) data.resize(6,0);
+    if (data.size() < (size_t)kNumStats) data.resize(kNumStats, 0);
     ttl_ex += new_ex();
     nnz_w += new_w();
 
@@ -22,18 +32,25 @@ struct Progress {
     char buf[256];
     snprintf(buf, 256, "%8.3g  %8.3g  %11.6g  %8.6lf  %8.6lf  %8.6lf",
              ttl_ex, new_ex(), nnz_w, objv() / new_ex(),
-             acc() / count(), auc() / count());
+             acc() / count(), AUCHistogram::AUC(auc_pos(), auc_neg()));
     return std::string(buf);
   }
 
   // mutator
   double& objv() { return data[0]; }
   double& acc() { return data[1]; }
-  double& auc() { return data[2]; }
 
-  double& count() { return data[3]; }
-  double& new_ex() { return data[4]; }
-  double& new_w() { return data[5]; }
+  double& count() { return data[2]; }
+  double& new_ex() { return data[3]; }
+  double& new_w() { return data[4]; }
+
+  /// \brief the histograms of the predictions of positive and negative
+  /// examples, which are appended to data at the first access
+  double* auc_pos() {
+    data.resize(kNumStats + 2 * AUCHistogram::kBuckets, 0);
+    return data.data() + kNumStats;
+  }
+  double* auc_neg() { return auc_pos() + AUCHistogram::kBuckets; }
 
   std::vector<double> data;
   double ttl_ex = 0, nnz_w = 0;
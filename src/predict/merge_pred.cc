@@ -0,0 +1,146 @@
+/**
+ * @file   merge_pred.cc
+ * @brief  Merges the prediction files of the workers, one per part of an input
+ * file, into a single file in the order of the input
+ */
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include "dmlc/io.h"
+#include "dmlc/logging.h"
+#include "dmlc/omp.h"
+#include "io/filesys.h"
+#include "base/match_file.h"
+#include "base/prediction_writer.h"
+
+using namespace std;
+using namespace dmlc;
+
+// the name after the last '/'
+string BaseName(const string& path) {
+  size_t pos = path.find_last_of("/\\");
+  return pos == string::npos ? path : path.substr(pos+1);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    cout << "Usage: predict_out=<predict_out of training> out=<merged file>"
+         << " [data_in=<data of training>] [binary=0] [text_out=0]"
+         << " [num_threads=#cores]\n"
+         << "The parts of an input file are merged in order. The input files"
+         << " are in the order data_in is matched, which is the order of the"
+         << " workloads, or in the order of their names if data_in is not"
+         << " given. If binary=1, the files have float32 predictions, and"
+         << " text_out=1 merges them into text.\n";
+    return 0;
+  }
+  string predict_out, out, data_in;
+  bool binary = false, text_out = false;
+  int nt = omp_get_num_procs();
+  for (int i = 1; i < argc; ++i) {
+    char name[256], val[256];
+    if (sscanf(argv[i], "%[^=]=%s", name, val) == 2) {
+      if (!strcmp(name, "predict_out")) predict_out = val;
+      if (!strcmp(name, "out")) out = val;
+      if (!strcmp(name, "data_in")) data_in = val;
+      if (!strcmp(name, "binary")) binary = atoi(val);
+      if (!strcmp(name, "text_out")) text_out = atoi(val);
+      if (!strcmp(name, "num_threads")) nt = atoi(val);
+    }
+  }
+  CHECK(!text_out || binary) << "text_out=1 needs binary=1";
+
+  // the files predict_out + input name + "_part-k-of-n", grouped by input name
+  size_t pos = predict_out.find_last_of("/\\");
+  string dir = pos == string::npos ? "./" : predict_out.substr(0, pos);
+  string prefix = BaseName(predict_out);
+  io::URI dir_uri(dir.c_str());
+  vector<io::FileInfo> info;
+  io::FileSystem::GetInstance(dir_uri.protocol)->ListDirectory(dir_uri, &info);
+  map<string, vector<pair<int, string>>> parts;
+  // the number of parts of each input
+  map<string, int> num_parts;
+  const string tag = "_part-";
+  for (const auto& f : info) {
+    string path = f.path.str(), name = BaseName(path);
+    size_t t = name.rfind(tag);
+    int k, n, len = 0;
+    if (name.compare(0, prefix.size(), prefix) || t == string::npos ||
+        t < prefix.size() ||
+        sscanf(name.c_str() + t + tag.size(), "%d-of-%d%n", &k, &n, &len) != 2 ||
+        t + tag.size() + len != name.size()) {
+      continue;
+    }
+    string in = name.substr(prefix.size(), t - prefix.size());
+    CHECK(!num_parts.count(in) || num_parts[in] == n)
+        << "the predictions of " << in << " have different numbers of parts";
+    num_parts[in] = n;
+    parts[in].push_back(make_pair(k, path));
+  }
+  // all parts must be there, or the rows of a missing one would be lost
+  for (auto& p : parts) {
+    sort(p.second.begin(), p.second.end());
+    int n = num_parts[p.first];
+    CHECK_EQ(p.second.size(), (size_t)n)
+        << "the predictions of " << p.first << " have " << p.second.size()
+        << " of " << n << " parts";
+    for (int k = 0; k < n; ++k) {
+      CHECK_EQ(p.second[k].first, k) << "the predictions of " << p.first
+                                     << " miss part " << k;
+    }
+  }
+
+  // the order of the input files
+  vector<string> inputs;
+  if (data_in.size()) {
+    vector<string> files;
+    MatchFile(data_in, &files);
+    for (const auto& f : files) {
+      string name = BaseName(f);
+      if (parts.count(name)) {
+        inputs.push_back(name);
+      } else {
+        LOG(WARNING) << "no predictions of " << f;
+      }
+    }
+    CHECK_EQ(inputs.size(), parts.size())
+        << "some prediction files are not from " << data_in;
+  } else {
+    for (const auto& p : parts) inputs.push_back(p.first);
+  }
+
+  Stream* fo = CHECK_NOTNULL(Stream::Create(out.c_str(), "w"));
+  PredictionWriter text(fo, false);
+  const size_t kBufSize = 1 << 26;
+  vector<char> buf(kBufSize);
+  size_t num_files = 0, num_bytes = 0, id = 0;
+  for (const auto& in : inputs) {
+    for (const auto& part : parts[in]) {
+      Stream* fi = CHECK_NOTNULL(Stream::Create(part.second.c_str(), "r"));
+      // rest bytes of a float not read completely yet
+      size_t n, rest = 0, file_bytes = 0;
+      while ((n = fi->Read(buf.data() + rest, kBufSize - rest)) > 0) {
+        file_bytes += n;
+        if (!text_out) {
+          fo->Write(buf.data(), n);
+          continue;
+        }
+        n += rest;
+        rest = n % sizeof(float);
+        text.Write(id++, (const float*)buf.data(), n / sizeof(float), nt);
+        memmove(buf.data(), buf.data() + n - rest, rest);
+      }
+      CHECK(!binary || file_bytes % sizeof(float) == 0)
+          << part.second << " is not a binary prediction file";
+      num_bytes += file_bytes;
+      delete fi;
+      ++ num_files;
+    }
+  }
+  delete fo;
+  printf("merged %zu files of %zu inputs, %zu bytes\n", num_files,
+         inputs.size(), num_bytes);
+  return 0;
+}
@@ -0,0 +1,101 @@
+/**
+ * @file   predict.cc
+ * @brief  Predicts a dataset by a difacto or linear model on all cores of a
+ * single machine, without the scheduler, the servers and the workers
+ */
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+#include "dmlc/io.h"
+#include "dmlc/logging.h"
+#include "dmlc/omp.h"
+#include "base/flat_model.h"
+#include "base/scorer.h"
+#include "base/minibatch_iter.h"
+#include "base/spmv.h"
+#include "base/prediction_writer.h"
+#include "base/now.h"
+
+using namespace std;
+using namespace dmlc;
+typedef uint64_t FeaID;
+
+int main(int argc, char *argv[]) {
+  if (argc < 4) {
+    cout << "Usage: model_in=<flat model> data_in=<data> predict_out=<out>"
+         << " [data_format=libsvm] [prob_predict=0] [num_threads=#cores]"
+         << " [parse_threads=2] [minibatch=100000] [max_key=<max_key>]"
+         << " [l1_shrk=1] [predict_binary=0]\n";
+    return 0;
+  }
+  string model_in, data_in, predict_out, data_format = "libsvm";
+  bool prob_predict = false, l1_shrk = true, predict_binary = false;
+  int nt = omp_get_num_procs(), parse_threads = 2, minibatch = 100000;
+  uint64_t max_key = numeric_limits<FeaID>::max();
+  for (int i = 1; i < argc; ++i) {
+    char name[256], val[256];
+    if (sscanf(argv[i], "%[^=]=%s", name, val) == 2) {
+      if (!strcmp(name, "model_in")) model_in = val;
+      if (!strcmp(name, "data_in")) data_in = val;
+      if (!strcmp(name, "predict_out")) predict_out = val;
+      if (!strcmp(name, "data_format")) data_format = val;
+      if (!strcmp(name, "prob_predict")) prob_predict = atoi(val);
+      if (!strcmp(name, "num_threads")) nt = atoi(val);
+      if (!strcmp(name, "parse_threads")) parse_threads = atoi(val);
+      if (!strcmp(name, "minibatch")) minibatch = atoi(val);
+      if (!strcmp(name, "max_key")) max_key = strtoull(val, NULL, 10);
+      if (!strcmp(name, "l1_shrk")) l1_shrk = atoi(val);
+      if (!strcmp(name, "predict_binary")) predict_binary = atoi(val);
+    }
+  }
+
+  double start = Now();
+  FlatModel model(model_in);
+  Scorer scorer(model, max_key, l1_shrk);
+  printf("mapped %zu keys in %.3f sec\n", model.size(), Now() - start);
+
+  // the parsers run in background threads, and the minibatches are scored and
+  // written in order
+  data::MinibatchIter<FeaID> reader(
+      data_in.c_str(), 0, 1, data_format.c_str(), minibatch, 0, 1.0,
+      parse_threads);
+  Stream* fo = CHECK_NOTNULL(Stream::Create(predict_out.c_str(), "w"));
+  PredictionWriter writer(fo, predict_binary);
+  vector<float> py;
+  RowSegments rows;
+  size_t num_rows = 0, num_mb = 0, nnz = 0, num_missed = 0;
+  double score_time = 0;
+  start = Now();
+  while (reader.Next()) {
+    const auto& blk = reader.Value();
+    double t = Now();
+    // split the rows among threads by nnz
+    py.resize(blk.size);
+    rows.Init(blk, nt);
+    size_t missed = 0;
+#pragma omp parallel for num_threads(nt) reduction(+:missed)
+    for (size_t k = 0; k < rows.size(); ++k) {
+      scorer.Score(blk, rows[k].begin, rows[k].end, py.data(), prob_predict,
+                   &missed);
+    }
+    num_missed += missed;
+    nnz += blk.offset[blk.size] - blk.offset[0];
+    score_time += Now() - t;
+
+    writer.Write(num_mb++, py.data(), py.size(), nt);
+    num_rows += blk.size;
+  }
+  delete fo;
+  double total = Now() - start;
+  printf("predicted %zu rows in %.2f sec, %.0f rows/sec, scoring %.0f rows/sec\n",
+         num_rows, total, num_rows / total, num_rows / score_time);
+  // the keys of a server part missing from the model are scored as 0 silently,
+  // which shows up only as many missing features
+  double missed = nnz ? (double)num_missed / nnz : 0;
+  printf("%.2f%% of the features are not in the model\n", missed * 100);
+  LOG_IF(WARNING, missed > .5)
+      << "most features are not in the model, check it was exported from the "
+      << "parts of all servers, with the same max_key as in training";
+  return 0;
+}
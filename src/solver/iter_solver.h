@@ -3,6 +3,7 @@
  * @brief  Template for an iterate solver
  */
 #include "solver/data_parallel.h"
+#include "base/prediction_writer.h"
 namespace dmlc {
 namespace solver {
 
@@ -78,13 +79,19 @@ class IterServer : public ps::App {
  protected:
   /**
    * \brief Save model to disk
+   *
+   * @param fo the model file
+   * @param filename the name of fo, which may prefix more files of the model
    */
-  virtual void SaveModel(Stream* fo) const = 0;
+  virtual void SaveModel(Stream* fo, const std::string& filename) const = 0;
 
   /**
    * \brief Load model from disk
+   *
+   * @param fi the model file
+   * @param filename the name of fi
    */
-  virtual void LoadModel(Stream* fi) = 0;
+  virtual void LoadModel(Stream* fi, const std::string& filename) = 0;
 
   /**
    * \brief Report the progress to the scheduler
@@ -102,11 +109,11 @@ class IterServer : public ps::App {
     auto filename = ModelName(request->task.msg(), cmd.iter());
     if (cmd.save_model()) {
       Stream* fo = CHECK_NOTNULL(Stream::Create(filename.c_str(), "w"));
-      SaveModel(fo);
+      SaveModel(fo, filename);
       delete fo;
     } else if (cmd.load_model()) {
       Stream* fi = CHECK_NOTNULL(Stream::Create(filename.c_str(), "r"));
-      LoadModel(fi);
+      LoadModel(fi, filename);
       delete fi;
     }
   }
@@ -132,37 +139,55 @@ class IterWorker : public DataParWorker {
   void ReportToScheduler(const Progress& prog) { reporter_.Push(prog); }
 
   /**
-   * \brief Returns stream for output prediction
+   * \brief Returns the writer of the predictions of a workload, which writes
+   * the file filename + the name of the input file + "_part-k-of-n" for part k
+   * of the n parts of the input. It is closed by \ref ClosePredictWriter when
+   * the workload is done.
    *
    * \param filename the predict out filename
+   * \param binary if true, write float32 instead of text
    * \param wl the received workload
    */
-  Stream* PredictStream(const std::string& filename, const Workload& wl) {
+  PredictionWriter* PredictWriter(const std::string& filename, bool binary,
+                                  const Workload& wl) {
     CHECK_EQ(wl.type, Workload::PRED);
     CHECK_GE(wl.file.size(), (size_t)1);
 
     auto in = wl.file[0].filename;
     size_t pos = in.find_last_of("/\\");
     auto in_base = pos == std::string::npos ? in : in.substr(pos+1);
-    auto out = filename + in_base + "_part-" + std::to_string(wl.file[0].k);
+    auto out = filename + in_base + "_part-" + std::to_string(wl.file[0].k) +
+               "-of-" + std::to_string(wl.file[0].n);
 
     if (out != prev_out_) {
-      delete pred_out_;
+      ClosePredictWriter();
       pred_out_ = CHECK_NOTNULL(Stream::Create(out.c_str(), "w"));
+      pred_writer_ = new PredictionWriter(pred_out_, binary);
       prev_out_ = out;
     }
 
-    return pred_out_;
+    return pred_writer_;
+  }
+
+  /**
+   * \brief Closes the prediction file, after all predictions of the workload
+   * are written
+   */
+  void ClosePredictWriter() {
+    delete pred_writer_; pred_writer_ = NULL;
+    delete pred_out_; pred_out_ = NULL;
+    prev_out_.clear();
   }
 
   // implementation
  public:
   IterWorker() { }
-  virtual ~IterWorker() {  delete pred_out_; }
+  virtual ~IterWorker() { ClosePredictWriter(); }
 
  private:
   ps::Slave<double> reporter_;
   Stream* pred_out_ = NULL;
+  PredictionWriter* pred_writer_ = NULL;
   std::string prev_out_;
 };
 
@@ -4,6 +4,10 @@
  */
 #include "solver/iter_solver.h"
 #include "base/minibatch_iter.h"
+#include "base/localized_cache.h"
+#include "base/object_pool.h"
+#include "base/threadsafe_limited_queue.h"
+#include "base/thread_pool.h"
 namespace dmlc {
 namespace solver {
 
@@ -197,6 +201,42 @@ class MinibatchScheduler : public IterScheduler {
 
 using MinibatchServer = IterServer;
 
+/**
+ * \brief The busy and the idle time of a pipeline stage, which may run on
+ * several threads. Thread-safe.
+ */
+class StageTime {
+ public:
+  void Busy(double sec) { std::lock_guard<std::mutex> lk(mu_); busy_ += sec; }
+  void Idle(double sec) { std::lock_guard<std::mutex> lk(mu_); idle_ += sec; }
+  void Clear() { std::lock_guard<std::mutex> lk(mu_); busy_ = idle_ = 0; }
+  double busy() { std::lock_guard<std::mutex> lk(mu_); return busy_; }
+
+  std::string ShortDebugString() {
+    std::lock_guard<std::mutex> lk(mu_);
+    char buf[64];
+    snprintf(buf, sizeof(buf), "busy %.2lf sec, idle %.2lf sec", busy_, idle_);
+    return buf;
+  }
+ private:
+  std::mutex mu_;
+  double busy_ = 0, idle_ = 0;
+};
+
+/**
+ * \brief The worker of a minibatch solver.
+ *
+ * A workload is processed by a pipeline of stages with bounded queues between
+ * them:
+ *
+ * - parse: the parser threads and a reading thread which forms minibatches
+ * - localize: \a localize_threads_ threads calling \ref LocalizeMinibatch
+ * - pull: the thread of \ref Process calling \ref ProcessMinibatch, which
+ *   issues the pull of at most \a max_concurrency minibatches
+ * - compute and push: the pull callbacks of ps-lite hand the work to \ref
+ *   Compute, which runs it on \a compute_threads_ threads, and a subclass
+ *   times it by \ref ComputeTime
+ */
 class MinibatchWorker : public IterWorker {
  protected:
   /**
@@ -209,6 +249,16 @@ class MinibatchWorker : public IterWorker {
    */
   using Minibatch = dmlc::RowBlock<FeaID>;
 
+  /**
+   * \brief The buffers of a minibatch passed from \ref LocalizeMinibatch to
+   * \ref ProcessMinibatch. A subclass derives its own.
+   */
+  struct MinibatchBuffer {
+    virtual ~MinibatchBuffer() { }
+    /// \brief the position of the minibatch in the workload
+    size_t id = 0;
+  };
+
   /**
    * \brief minibatch size
    */
@@ -242,15 +292,101 @@ class MinibatchWorker : public IterWorker {
   int val_concurrent_mb_ = 10;
 
   /**
-   * \brief the time spent on real workload such as computing gradients. for
-   * profiling usage
+   * \brief If not empty, a local directory to cache the parsed data. Data
+   * passes after the first one read the cache instead of parsing again.
+   */
+  std::string data_cache_;
+
+  /**
+   * \brief If > 0, keep the localized minibatches with at most this many MB in
+   * memory, and spill the rest into \a data_cache_ if given. Only used when
+   * the minibatches are the same in every data pass, namely no shuffle and no
+   * negative sampling.
    */
-  double workload_time_ = 0;
+  int localized_cache_ = 0;
 
   /**
-   * \brief Process one minibatch
+   * \brief the number of threads to parse a chunk of text data
    */
-  virtual void ProcessMinibatch(const Minibatch& mb, const Workload& wl) = 0;
+  int parse_threads_ = 2;
+
+  /**
+   * \brief the number of threads localizing minibatches at the same time
+   */
+  int localize_threads_ = 1;
+
+  /**
+   * \brief the number of threads computing and pushing gradients. If 0, they
+   * run on the ps-lite executor thread, which then stops receiving the pulled
+   * weights of other minibatches meanwhile.
+   */
+  int compute_threads_ = 0;
+
+  /**
+   * \brief the predict out filename and whether to write float32 predictions,
+   * see \ref PredictWriter
+   */
+  std::string predict_out_;
+  bool predict_binary_ = false;
+
+  /**
+   * \brief Localizes a minibatch. It runs on one of the localize threads,
+   * concurrently with parsing and with the other minibatches.
+   *
+   * @param mb the minibatch
+   * @param id the position of the minibatch in the workload
+   * @return the buffers for \ref ProcessMinibatch
+   */
+  virtual MinibatchBuffer* LocalizeMinibatch(
+      const Minibatch& mb, size_t id, const Workload& wl) = 0;
+
+  /**
+   * \brief Issues the pull of a localized minibatch. The gradients are then
+   * computed and pushed in the callbacks. It runs on the thread of \ref Process.
+   */
+  virtual void ProcessMinibatch(MinibatchBuffer* buf, const Workload& wl) = 0;
+
+  /**
+   * \brief Gets the localized data and the unique feature ids of minibatch \a
+   * id saved by \ref PutLocalized in a previous data pass. Returns false if
+   * not found.
+   */
+  bool GetLocalized(size_t id, dmlc::data::RowBlockContainer<unsigned>* data,
+                    std::vector<FeaID>* feaid) {
+    if (mb_key_.empty()) return false;
+    std::lock_guard<std::mutex> lk(localized_mu_);
+    return localized_->Get(mb_key_ + std::to_string(id), data, feaid);
+  }
+
+  /**
+   * \brief Saves the localized data and the unique feature ids of minibatch \a
+   * id for later data passes
+   */
+  void PutLocalized(size_t id,
+                    const dmlc::data::RowBlockContainer<unsigned>& data,
+                    const std::vector<FeaID>& feaid) {
+    if (mb_key_.empty()) return;
+    std::lock_guard<std::mutex> lk(localized_mu_);
+    localized_->Put(mb_key_ + std::to_string(id), data, feaid);
+  }
+
+  /**
+   * \brief Runs the computation of a pulled minibatch, such as evaluating and
+   * pushing the gradients. A pull callback should only call this function, so
+   * the executor thread returns to receiving messages at once.
+   */
+  void Compute(const std::function<void()>& task) {
+    if (compute_pool_) {
+      compute_pool_->Add(task);
+    } else {
+      task();
+    }
+  }
+
+  /**
+   * \brief Adds the time spent on computing and pushing gradients
+   */
+  void ComputeTime(double sec) { compute_.Busy(sec); }
 
   /**
    * \brief Mark one minibatch is finished
@@ -265,10 +401,11 @@ class MinibatchWorker : public IterWorker {
 
     // log info
     double time = (GetTime() - start_);
+    double workload_time = compute_.busy();
     std::string overhead;
-    if (workload_time_ > 0) {
+    if (workload_time > 0) {
       overhead = "overhead " + std::to_string(
-          std::max(time - workload_time_, (double)0) / time * 100) + "%, ";
+          std::max(time - workload_time, (double)0) / time * 100) + "%, ";
     }
     LOG(INFO) << num_mb_done_ << " done, avg time "
               << time / num_mb_done_ << ", " << overhead
@@ -286,32 +423,116 @@ class MinibatchWorker : public IterWorker {
     int   mb_size = train ? mb_size_ : val_mb_size_;
     int   shuffle = train ? mb_size_ * shuffle_ : 0;
     float neg_sp  = train ? neg_sampling_ : 1.0;
-    int max_mb    = wl.type == Workload::PRED ? 1 :
-                    (train ? concurrent_mb_ : val_concurrent_mb_);
+    int max_mb    = train ? concurrent_mb_ : val_concurrent_mb_;
+    int nt_lc     = std::max(localize_threads_, 1);
     LOG(INFO) << wl.ShortDebugString()
               << ", minibatch = " << mb_size
               << ", concurrency = " <<  max_mb
               << ", shuffle ratio = " << shuffle
-              << ", negative sampling = " << neg_sp;
+              << ", negative sampling = " << neg_sp
+              << ", localize threads = " << nt_lc;
 
     num_mb_fly_ = num_mb_done_ = 0;
     start_ = GetTime();
-    workload_time_ = 0;
+    for (auto t : {&parse_, &localize_, &pull_, &compute_}) t->Clear();
+
+    if (compute_threads_ > 0 && !compute_pool_) {
+      compute_pool_.reset(new ps::ThreadPool(compute_threads_));
+      compute_pool_->StartWorkers();
+    }
 
     CHECK_GE(wl.file.size(), (size_t)1);
     auto file = wl.file[0];
     dmlc::data::MinibatchIter<FeaID> reader(
         file.filename.c_str(), file.k, file.n, file.format.c_str(),
-        mb_size, shuffle, neg_sp);
+        mb_size, shuffle, neg_sp, parse_threads_, data_cache_);
     reader.BeforeFirst();
-    while (reader.Next()) {
+
+    // open the prediction file before any minibatch, so a part without rows
+    // still has its file, and merging can check that no part is missing
+    if (wl.type == Workload::PRED) {
+      PredictWriter(predict_out_, predict_binary_, wl);
+    }
+
+    // the minibatches are identified by the part and their positions in it
+    bool cache = localized_cache_ > 0 && shuffle == 0 && neg_sp >= 1;
+    if (cache && !localized_) {
+      localized_.reset(new LocalizedCache<FeaID>(
+          (size_t)localized_cache_ << 20, data_cache_));
+    }
+    mb_key_.clear();
+    if (cache) {
+      mb_key_ = std::to_string(mb_size) + " " + file.format + " " +
+                file.ShortDebugString() + " ";
+    }
+
+    // parse -> localize -> pull, each queue holds at most nt_lc minibatches
+    ps::ThreadsafeLimitedQueue<ParsedMinibatch*> parsed(nt_lc);
+    ps::ThreadsafeLimitedQueue<MinibatchBuffer*> localized(nt_lc);
+
+    std::thread parse_thr([&]() {
+        for (size_t id = 0; ; ++id) {
+          double start = GetTime();
+          if (!reader.Next()) break;
+          ParsedMinibatch* mb = mb_pool_.Get();
+          reader.Swap(&mb->data);
+          mb->id = id;
+          double t = GetTime();
+          parse_.Busy(t - start);
+          parsed.push(mb, 1);
+          parse_.Idle(GetTime() - t);
+        }
+        parsed.push(NULL, 0, true);
+      });
+
+    std::atomic<int> nt_running(nt_lc);
+    std::vector<std::thread> localize_thr;
+    for (int i = 0; i < nt_lc; ++i) {
+      localize_thr.emplace_back([&]() {
+          ParsedMinibatch* mb;
+          while (true) {
+            double start = GetTime();
+            if (!parsed.pop(mb)) break;
+            double t = GetTime();
+            localize_.Idle(t - start);
+            MinibatchBuffer* buf =
+                LocalizeMinibatch(mb->data.GetBlock(), mb->id, wl);
+            buf->id = mb->id;
+            mb_pool_.Put(mb);
+            start = GetTime();
+            localize_.Busy(start - t);
+            localized.push(buf, 1);
+            localize_.Idle(GetTime() - start);
+          }
+          if (-- nt_running == 0) localized.push(NULL, 0, true);
+        });
+    }
+
+    while (true) {
+      double start = GetTime();
+      MinibatchBuffer* buf;
+      if (!localized.pop(buf)) break;
       WaitMinibatch(max_mb);
-      ProcessMinibatch(reader.Value(), wl);
+      double t = GetTime();
+      pull_.Idle(t - start);
       mb_mu_.lock(); ++ num_mb_fly_; mb_mu_.unlock();
+      ProcessMinibatch(buf, wl);
+      pull_.Busy(GetTime() - t);
     }
+    parse_thr.join();
+    for (auto& t : localize_thr) t.join();
 
     // wait untill all are done
     WaitMinibatch(1);
+    mb_key_.clear();
+    if (wl.type == Workload::PRED) ClosePredictWriter();
+
+    double time = GetTime() - start_;
+    compute_.Idle(std::max(time - compute_.busy(), (double)0));
+    LOG(INFO) << "parse: " << parse_.ShortDebugString()
+              << "; localize: " << localize_.ShortDebugString()
+              << "; pull: " << pull_.ShortDebugString()
+              << "; compute and push: " << compute_.ShortDebugString();
   }
 
  private:
@@ -327,6 +548,21 @@ class MinibatchWorker : public IterWorker {
   std::condition_variable mb_cond_;
   double start_;
 
+  /// \brief a minibatch from the parse stage
+  struct ParsedMinibatch {
+    dmlc::data::RowBlockContainer<FeaID> data;
+    size_t id;
+  };
+  // reused to keep the buffers
+  ObjectPool<ParsedMinibatch> mb_pool_;
+
+  StageTime parse_, localize_, pull_, compute_;
+  std::unique_ptr<ps::ThreadPool> compute_pool_;
+
+  std::unique_ptr<LocalizedCache<FeaID>> localized_;
+  std::mutex localized_mu_;
+  // the key prefix of the minibatches in localized_, empty if not cached
+  std::string mb_key_;
 };
 
 }  // namespace solver
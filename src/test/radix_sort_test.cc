@@ -0,0 +1,80 @@
+#include <gtest/gtest.h>
+#include <stdint.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+#include "base/radix_sort.h"
+
+using namespace dmlc;
+
+namespace {
+struct Pair {
+  uint64_t k;
+  unsigned i;
+};
+
+// n pairs with random keys in [0, max_key], i is the position
+std::vector<Pair> RandPairs(size_t n, uint64_t max_key) {
+  std::mt19937_64 gen(0);
+  std::uniform_int_distribution<uint64_t> dis(0, max_key);
+  std::vector<Pair> a(n);
+  for (size_t i = 0; i < n; ++i) a[i] = {dis(gen), (unsigned)i};
+  return a;
+}
+
+// a is sorted by k, and stable
+void CheckSorted(const std::vector<Pair>& a, const std::vector<Pair>& input) {
+  std::vector<Pair> b = input;
+  std::stable_sort(b.begin(), b.end(),
+                   [](const Pair& x, const Pair& y) { return x.k < y.k; });
+  ASSERT_EQ(a.size(), b.size());
+  for (size_t i = 0; i < a.size(); ++i) {
+    ASSERT_EQ(a[i].k, b[i].k) << i;
+    ASSERT_EQ(a[i].i, b[i].i) << i;
+  }
+}
+
+void SortAndCheck(RadixSorter<Pair>* sorter, const std::vector<Pair>& input) {
+  std::vector<Pair> a = input;
+  sorter->Sort(&a, [](const Pair& p) { return p.k; });
+  CheckSorted(a, input);
+}
+}  // namespace
+
+TEST(RadixSorter, Small) {
+  RadixSorter<Pair> sorter(4);
+  SortAndCheck(&sorter, RandPairs(1000, (uint64_t)-1));
+  SortAndCheck(&sorter, RandPairs(1000, 100));
+}
+
+TEST(RadixSorter, SingleThread) {
+  size_t n = RadixSorter<Pair>::kMinParallel * 3;
+  RadixSorter<Pair> sorter(1);
+  SortAndCheck(&sorter, RandPairs(n, (uint64_t)-1));
+}
+
+TEST(RadixSorter, MultiThread) {
+  size_t n = RadixSorter<Pair>::kMinParallel * 3;
+  RadixSorter<Pair> sorter(4);
+  SortAndCheck(&sorter, RandPairs(n, (uint64_t)-1));
+  // duplicated keys, and skipped passes on the high digits
+  SortAndCheck(&sorter, RandPairs(n, 1000));
+  // the buffers are reused for a shorter array
+  SortAndCheck(&sorter, RandPairs(n / 2, (uint64_t)-1));
+}
+
+TEST(RadixSorter, FewerThreadsThanAsked) {
+  // openmp starts a single thread for the region nested in another one
+  size_t n = RadixSorter<Pair>::kMinParallel * 3;
+  auto input = RandPairs(n, (uint64_t)-1);
+  std::vector<Pair> a = input;
+#pragma omp parallel num_threads(2)
+  {
+#pragma omp single
+    {
+      RadixSorter<Pair> sorter(4);
+      sorter.Sort(&a, [](const Pair& p) { return p.k; });
+    }
+  }
+  CheckSorted(a, input);
+}